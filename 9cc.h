@@ -1,5 +1,6 @@
 #include <assert.h>
 #include <stdbool.h>
+#include <stddef.h>
 
 #define _POSIX_C_SOURCE 200809L
 
@@ -8,23 +9,117 @@ typedef struct Node Node;
 typedef struct Type Type;
 typedef struct Var Var;
 typedef struct Function Function;
+typedef struct BB BB;
+typedef struct Reg Reg;
 
+// alloc
+typedef struct ArenaBlock ArenaBlock;
+typedef struct
+{
+    char *name;
+    ArenaBlock *blocks;
+    size_t bytes; // 確保したバイト数の累計
+    long objects; // 確保したオブジェクト数の累計
+    size_t live;  // 解放せずに持っているバイト数
+    size_t peak;  // liveの最大値
+} Arena;
+
+extern Arena symbol_arena; // 名前の文字列, グローバル変数 (入力の最後まで残すもの)
+extern Arena node_arena;   // Node, ローカル変数, Function
+extern Arena type_arena;   // Type
+extern Arena ir_arena;     // IR, BB, Reg
+
+void *arena_alloc(Arena *arena, size_t size);
+char *arena_strndup(Arena *arena, char *s, int len);
+void arena_free(Arena *arena);
+void arena_reset(Arena *arena);
+void print_arena_stats();
+
+// emit
+void emit(char *fmt, ...);
+char *emit_opnd(char *fmt, ...);
+void emit_insn(char *op, char *dst, char *src);
+void emit_label(char *name);
+void emit_flush(char *path);
+void emit_close();
+void emit_function_begin();
+void emit_function_end();
+
+// peephole.c
+void peephole_insn(char *op, char *dst, char *src);
+void peephole_label(char *name);
+void peephole_directive(char *text);
+void peephole_flush();
+void print_peephole_stats();
+
+// hashmap
+typedef struct
+{
+    char *key;
+    void *val;
+} HashEntry;
+
+typedef struct
+{
+    HashEntry *buckets;
+    int capacity;
+    int used;
+} HashMap;
+
+char *intern(char *s, int len);
+void *hashmap_get(HashMap *map, char *key);
+void hashmap_put(HashMap *map, char *key, void *val);
+
+// 記号とキーワードはトークナイズ時にそれぞれ固有のkindに分類するので、
+// パーサはkindの整数比較だけでトークンを判定できる
 typedef enum
 {
-    TK_RESERVED, // 記号
-    TK_IDENT,    // 識別子
-    TK_NUM,      // 整数トークン
-    TK_EOF,      // 入力の終わりを表すトークン
-    TK_RETURN,   // return
+    TK_IDENT, // 識別子
+    TK_NUM,   // 整数トークン
+    TK_EOF,   // 入力の終わりを表すトークン
+
+    // 記号
+    TK_PLUS,     // +
+    TK_MINUS,    // -
+    TK_STAR,     // *
+    TK_SLASH,    // /
+    TK_AMP,      // &
+    TK_LPAREN,   // (
+    TK_RPAREN,   // )
+    TK_LBRACE,   // {
+    TK_RBRACE,   // }
+    TK_LBRACKET, // [
+    TK_RBRACKET, // ]
+    TK_COMMA,    // ,
+    TK_SEMI,     // ;
+    TK_ASSIGN,   // =
+    TK_EQ,       // ==
+    TK_NE,       // !=
+    TK_LT,       // <
+    TK_LE,       // <=
+    TK_GT,       // >
+    TK_GE,       // >=
+
+    // キーワード
+    TK_RETURN, // return
+    TK_IF,     // if
+    TK_ELSE,   // else
+    TK_FOR,    // for
+    TK_WHILE,  // while
+    TK_INT,    // int
+    TK_CHAR,   // char
+    TK_LONG,   // long
+    TK_SIZEOF, // sizeof
 } TokenKind;
 
 struct Token
 {
     TokenKind kind; // トークンの型
-    Token *next;    // 次の入力トークン
     int val;        // kindがTK_NUMの場合、その数値
+    char *name;     // kindがTK_IDENTの場合、intern()済みの名前
     char *str;      // トークン文字列
     int len;        // トークンの長さ
+    int line_no;    // 行番号 (1始まり)
 };
 
 // ローカル変数の型
@@ -35,6 +130,11 @@ struct Var
     Type *ty;   // Type
     int offset; // Offset from RBP
     bool is_local;
+
+    // レジスタへの昇格 (ir.c)
+    bool addr_taken; // &で参照される
+    int uses;        // 参照の多さ。ループの中の参照は重く数える
+    Reg *reg;        // 昇格した場合に値を置くレジスタ
 };
 
 typedef struct VarList VarList;
@@ -49,9 +149,15 @@ struct Function
     Function *next;
     VarList *params;
     char *name;
-    Node *body[100];
+    Type *ty;   // 戻り値の型
+    Node *body; // 文の連結リスト
     VarList *locals;
     int stack_size;
+
+    BB *bbs;        // 中間表現に変換した本体
+    int nregs;      // 仮想レジスタの数
+    int used_regs;  // 割り当てで使った実レジスタ (ビットの集合)
+    int var_regs;   // 変数に占有させた実レジスタ (ビットの集合)
 };
 
 typedef struct
@@ -61,13 +167,22 @@ typedef struct
 } Program;
 
 Program *program();
+Function *next_function(Program *prog);
 
-Token *peek(char *s);
-void expect(char *op);
+Token *peek(TokenKind kind);
+void expect(TokenKind kind);
+int expect_number();
+bool at_eof();
+void next_token();
+long mark_token();
+void rewind_token(long pos);
+extern char *filename;
 extern char *user_input;
+// トークナイザはuser_inputの終端のNULから、このバイト数だけ先まで読むことがある
+#define INPUT_PADDING 32
 extern Token *token;
 
-Token *tokenize();
+void tokenize();
 
 typedef enum
 {
@@ -91,66 +206,210 @@ typedef enum
     ND_FUNCALL,
     ND_NULL,
     ND_EXPR_STMT,
-    ND_SIZEOF, // "sizeof"
+    ND_INLINE, // インライン展開した関数呼び出し (inline.c)
 } NodeKind;
 
 // 抽象構文木のノードの型
+// kindごとに使うフィールドが異なるので、共用体に重ねて置く
 struct Node
 {
     NodeKind kind; // ノードの型
-    Node *lhs;     // 左辺
-    Node *rhs;     // 右辺
-    // TODO: Nodeを連結リストにする
-    Node *body[100]; // kindがND_BLOCKの場合のみ使う
-    Type *ty;        // Type, e.g. int or pointer to int
-
-    // kindがND_IFかFORの場合のみ使う
-    Node *cond;
-    Node *then;
-    Node *els;
-    Node *init;
-    Node *inc;
+    int line_no;   // ソース上の行番号。文のノードでは文の先頭の行
+    Node *next;    // ブロック内の次の文、または次の引数
+    Type *ty;      // Type, e.g. int or pointer to int
 
-    char *funcname;
-    Node *args[6];
+    union
+    {
+        // 演算子, ND_ASSIGN, ND_ADDR, ND_DEREF, ND_RETURN,
+        // ND_EXPR_STMT, ND_INLINE
+        struct
+        {
+            Node *lhs; // 左辺
+            Node *rhs; // 右辺
+        };
+
+        // kindがND_IFかFORの場合のみ使う
+        struct
+        {
+            Node *cond;
+            Node *then;
+            Node *els;
+            Node *init;
+            Node *inc;
+        };
 
-    Var *var; // kindがND＿LVARの場合のみ使う
-    int val;  // kindがND＿NUMの場合のみ使う
+        // kindがND_BLOCKの場合のみ使う
+        Node *body;
+
+        // kindがND_FUNCALLの場合のみ使う
+        struct
+        {
+            char *funcname;
+            Node *args;
+        };
+
+        Var *var; // kindがND＿LVARの場合のみ使う
+        int val;  // kindがND＿NUMの場合のみ使う
+    };
 };
 
 typedef enum
 {
     TY_CHAR,
     TY_INT,
+    TY_LONG,
     TY_PTR,
     TY_ARRAY,
 } TypeKind;
 
+// 型は構造ごとに1つだけ作るので、同じ型かどうかはポインタで比べられる
 struct Type
 {
     TypeKind kind;
+    int size;  // サイズ (バイト)
+    int align; // アラインメント (バイト)
     Type *base;
     int array_size;
-};
 
-extern Type *ty_int;
+    // 派生した型の表 (type.c)
+    Type *pointer; // この型へのポインタ
+    Type *arrays;  // この型の配列。要素数の異なるものをnextでつなぐ
+    Type *next;
+};
 
 Type *char_type();
 Type *int_type();
+Type *long_type();
 Type *pointer_to(Type *base);
-void add_type(Program *prog);
+void add_type(Node *node, Token *tok);
 Type *array_of(Type *base, int size);
 int size_of(Type *ty);
 
 Program *program();
+void fold_constants(Program *prog);
+void fold_stmt(Node *node);
+void inline_functions(Program *prog);
+void optimize_loops(Program *prog);
+
+// ir.c
+// 関数本体を、基本ブロックと仮想レジスタからなる3番地コードに変換する
+typedef struct IR IR;
+
+// 仮想レジスタ
+struct Reg
+{
+    int vn;       // 仮想レジスタ番号
+    int rn;       // 割り当てた実レジスタの番号。-1ならスタックに置く
+    int offset;   // スタックに置く場合のRBPからのオフセット
+    char *name;   // スタックに置く場合のオペランド表記 (コード生成時に作る)
+    bool fixed;   // 変数を置くレジスタ。関数全体でrnを占有し、割り当ての対象外
+    int def;      // 生存区間の始まりと終わり (関数内の命令の通し番号)
+    int last_use;
+};
+
+typedef enum
+{
+    IR_IMM,       // dst = imm
+    IR_ADD,       // dst = a + b (bがNULLならa + imm。以下の2項演算も同じ)
+    IR_SUB,       // dst = a - b
+    IR_MUL,       // dst = a * b
+    IR_DIV,       // dst = a / b
+    IR_EQ,        // dst = a == b
+    IR_NE,        // dst = a != b
+    IR_LT,        // dst = a < b
+    IR_LE,        // dst = a <= b
+    IR_ADDR,      // dst = アドレス (a + idx*scale + imm。aがNULLならvarが基点)
+    IR_LOAD,      // dst = *アドレス (sizeバイト。アドレスはIR_ADDRと同じ)
+    IR_STORE,     // *アドレス = b (sizeバイト。アドレスはIR_ADDRと同じ)
+    IR_MOV,       // dst = a (dstはレジスタに昇格した変数。sizeが4ならintに切り詰める)
+    IR_STORE_ARG, // var = imm番目の引数
+    IR_CALL,      // dst = funcname(args...) (戻り値はsizeバイト)
+    IR_TAILCALL,  // return funcname(args...) (フレームを畳んでからジャンプする)
+    IR_JMP,       // goto bb1
+    IR_BR,        // if (a) goto bb1; else goto bb2
+    IR_BR_CMP,    // if (a cond b) goto bb1; else goto bb2 (bがNULLならimmと比べる)
+    IR_RETURN,    // return a
+} IRKind;
+
+struct IR
+{
+    IRKind kind;
+    IR *next;
+    int line_no; // 元になった文の行番号
+
+    Reg *dst;
+    Reg *a;
+    Reg *b;
+    long imm;
+    int size;
+    Var *var;
+    Reg *idx; // IR_ADDR, IR_LOAD, IR_STOREのアドレスの添字
+    int scale;
+
+    // IR_JMP, IR_BR, IR_BR_CMP
+    BB *bb1;
+    BB *bb2;
+    IRKind cond; // IR_BR_CMPの比較 (IR_EQ, IR_NE, IR_LT, IR_LE)
+
+    // IR_CALL, IR_TAILCALL
+    char *funcname;
+    Reg **args;
+    int nargs;
+};
+
+// 基本ブロック。途中に分岐も合流もない命令の列
+struct BB
+{
+    BB *next;
+    int label;
+    IR *ir;
+    IR *last;
+};
+
+void gen_ir(Program *prog);
+void dump_ir(Program *prog);
+
+// regalloc.c
+#define NREG 5 // 割り当てに使う実レジスタの数 (すべてcallee-saved)
+void alloc_regs(Program *prog);
+
 void codegen(Program *prog);
+void codegen_begin();
+void codegen_text(Program *prog);
+void codegen_data(Program *prog);
+
+// main
+extern bool opt_regalloc;  // 仮想レジスタを実レジスタに割り当てる。なければすべてスタックに置く
+extern bool opt_mem_stats; // アリーナの使用量を表示する
+extern bool opt_syntax_only; // 構文と型の検査だけ行い、コードを生成しない
+extern char *opt_output;     // 出力先のファイル名。NULLなら標準出力
+extern bool opt_debug;       // -g: 行番号情報(.file/.loc)を出力する
+extern bool opt_no_peephole; // 覗き穴最適化を行わない
+extern bool opt_dump_ir;     // 中間表現を標準エラー出力に書き出す
+extern bool opt_stream;      // 関数ごとにコード生成まで済ませ、その関数の構文木を解放する
+extern bool opt_no_simd;     // トークナイザでSIMD命令を使わない
+extern bool opt_no_loop_opt; // ループの最適化(不変式の移動と展開)を行わない
+extern int opt_inline_limit; // これ以下のノード数の関数をインライン展開する。0なら展開しない
 
 // log
+// デバッグ用のログは make LOG=1 でビルドしたときだけ組み込まれ、
+// 実行時に環境変数NINECC_LOGで指定したファイルに書き出される。
+// LOG=1なしでビルドすると、ログの呼び出しは引数も含めて何も生成しない。
+#ifdef ENABLE_LOG
 void init_log();
-void log(const char *fmt, ...);
-void log_tokens(Token *token);
-void log_nodes(Node *nodes[]);
+void log_printf(const char *fmt, ...);
+void log_tokens();
+void log_nodes(Node *nodes);
 void log_node(Node *node);
 void log_function(Function *fn);
+#define log(...) log_printf(__VA_ARGS__)
+#else
+#define init_log() ((void)0)
+#define log(...) ((void)0)
+#define log_tokens() ((void)0)
+#define log_nodes(nodes) ((void)0)
+#define log_node(node) ((void)0)
+#define log_function(fn) ((void)0)
+#endif
 void error_at(char *loc, char *fmt, ...);
 void error(char *fmt, ...);
@@ -0,0 +1,142 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include "9cc.h"
+
+// フェーズごとのアリーナ。
+// 小さなオブジェクトを大きなブロックから切り出して確保し、
+// コード生成が終わったらブロック単位でまとめて解放する。
+// --streamでは、node_arenaとir_arenaは関数1つごとに解放する。
+
+#define ARENA_BLOCK_SIZE (64 * 1024)
+#define ARENA_ALIGN 8
+
+typedef struct ArenaBlock ArenaBlock;
+struct ArenaBlock
+{
+    ArenaBlock *next;
+    char *cur; // 次に確保する位置
+    char *end; // ブロックの終わり
+    char buf[];
+};
+
+Arena symbol_arena = {"symbols"};
+Arena node_arena = {"ast"};
+Arena type_arena = {"types"};
+Arena ir_arena = {"ir"};
+
+static ArenaBlock *new_block(size_t size)
+{
+    // callocで確保するので、ブロックから切り出す領域はゼロ初期化済み
+    ArenaBlock *blk = calloc(1, sizeof(ArenaBlock) + size);
+    if (!blk)
+        error("メモリを確保できません");
+    blk->cur = blk->buf;
+    blk->end = blk->buf + size;
+    return blk;
+}
+
+// アリーナからゼロ初期化されたsizeバイトの領域を確保する
+void *arena_alloc(Arena *arena, size_t size)
+{
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+    ArenaBlock *blk = arena->blocks;
+    if (!blk || blk->end - blk->cur < size)
+    {
+        if (size > ARENA_BLOCK_SIZE / 4)
+        {
+            // 大きなオブジェクトは専用のブロックに置き、
+            // 現在のブロックの残りを無駄にしない
+            blk = new_block(size);
+            if (arena->blocks)
+            {
+                blk->next = arena->blocks->next;
+                arena->blocks->next = blk;
+            }
+            else
+            {
+                arena->blocks = blk;
+            }
+        }
+        else
+        {
+            blk = new_block(ARENA_BLOCK_SIZE);
+            blk->next = arena->blocks;
+            arena->blocks = blk;
+        }
+    }
+
+    void *p = blk->cur;
+    blk->cur += size;
+    arena->bytes += size;
+    arena->objects++;
+    arena->live += size;
+    if (arena->live > arena->peak)
+        arena->peak = arena->live;
+    return p;
+}
+
+char *arena_strndup(Arena *arena, char *s, int len)
+{
+    char *p = arena_alloc(arena, len + 1);
+    memcpy(p, s, len);
+    return p;
+}
+
+// アリーナのブロックをすべて解放する。統計値は残す。
+void arena_free(Arena *arena)
+{
+    ArenaBlock *blk = arena->blocks;
+    while (blk)
+    {
+        ArenaBlock *next = blk->next;
+        free(blk);
+        blk = next;
+    }
+    arena->blocks = NULL;
+    arena->live = 0;
+}
+
+// アリーナを空にする。関数ごとに使い捨てるアリーナで、
+// ブロックの確保と解放を繰り返さないよう先頭のブロックだけは残しておく。
+void arena_reset(Arena *arena)
+{
+    ArenaBlock *blk = arena->blocks;
+    if (!blk)
+        return;
+    ArenaBlock *rest = blk->next;
+    blk->next = NULL;
+    while (rest)
+    {
+        ArenaBlock *next = rest->next;
+        free(rest);
+        rest = next;
+    }
+    memset(blk->buf, 0, blk->cur - blk->buf);
+    blk->cur = blk->buf;
+    arena->live = 0;
+}
+
+// 確保の累計と、同時に持っていたバイト数の最大値を表示する
+void print_arena_stats()
+{
+    Arena *arenas[] = {&symbol_arena, &node_arena, &type_arena, &ir_arena};
+    size_t bytes = 0;
+    long objects = 0;
+
+    for (int i = 0; i < sizeof(arenas) / sizeof(*arenas); i++)
+    {
+        Arena *a = arenas[i];
+        fprintf(stderr, "%-8s %10zu bytes %8ld objects %10zu peak\n", a->name, a->bytes,
+                a->objects, a->peak);
+        bytes += a->bytes;
+        objects += a->objects;
+    }
+    fprintf(stderr, "%-8s %10zu bytes %8ld objects\n", "total", bytes, objects);
+
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    fprintf(stderr, "%-8s %10ld KB\n", "max rss", ru.ru_maxrss);
+}
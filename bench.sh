@@ -0,0 +1,118 @@
+#!/bin/bash
+# 9cc自身の処理時間を測るベンチマーク (make bench)
+# 引数はそのまま9ccに渡す
+
+flags="$*"
+
+# n個の関数からなる合成プログラムを出力する
+gen_program() {
+  n="$1"
+  for i in $(seq "$n"); do
+    echo "int f$i(int a, int b) { int x=a; int y=b; int i=0;"
+    echo "  for (i=0; i<10; i=i+1) { x = x + y * 2 - (a + b) / 3; if (x == y) y = y + 1; else x = x - 1; }"
+    echo "  while (x >= y) { x = x - (y + 1); } return x + y * (a - b); }"
+  done
+  echo "int main() { return 0; }"
+}
+
+# 字下げと長い名前を含む、人が書くものに近い見た目のプログラムを出力する。
+# トークナイザの速さを測るのに使う
+gen_indented_program() {
+  n="$1"
+  for i in $(seq "$n"); do
+    echo "int accumulate_values_$i(int first_argument, int second_argument) {"
+    echo "        int running_total = first_argument;"
+    echo "        int loop_counter = 0;"
+    echo "        for (loop_counter = 0; loop_counter < 10; loop_counter = loop_counter + 1) {"
+    echo "                running_total = running_total + second_argument * 2 - (first_argument + second_argument) / 3;"
+    echo "        }"
+    echo "        return running_total;"
+    echo "}"
+    echo
+  done
+  echo "int main() { return 0; }"
+}
+
+# グローバル変数の配列の総和を繰り返し求めるプログラム。生成したコードの実行時間を測る
+gen_array_sum() {
+  echo "int a[1000]; int w[4]; int total;"
+  echo "int main() { int i; int j; int r; int s=0; int n=1000;"
+  echo "  for (i=0; i<n; i=i+1) a[i]=i; for (j=0; j<4; j=j+1) w[j]=j+1;"
+  echo "  for (r=0; r<200000; r=r+1) { for (i=0; i<n; i=i+1) s=s+a[i];"
+  echo "    for (j=0; j<4; j=j+1) s=s+w[j]*a[r/200+j]; }"
+  echo "  total=s; return 0; }"
+}
+
+now_ns() {
+  date +%s%N
+}
+
+# bench <名前> <回数> <コマンド...>
+# コマンドを指定回数実行し、1回あたりの時間を表示する
+bench() {
+  name="$1"
+  iter="$2"
+  shift 2
+
+  start=$(now_ns)
+  for _ in $(seq "$iter"); do
+    "$@" > /dev/null || { echo "$name: failed"; exit 1; }
+  done
+  end=$(now_ns)
+
+  awk -v name="$name" -v ns="$((end - start))" -v n="$iter" \
+    'BEGIN { printf "%-24s %8.3f ms/run\n", name, ns / n / 1e6 }'
+}
+
+# bench_mbps <名前> <入力のバイト数> <回数> <コマンド...>
+# benchと同じように測り、1秒あたりに処理した入力の量を表示する
+bench_mbps() {
+  name="$1"
+  bytes="$2"
+  iter="$3"
+  shift 3
+
+  start=$(now_ns)
+  for _ in $(seq "$iter"); do
+    "$@" > /dev/null || { echo "$name: failed"; exit 1; }
+  done
+  end=$(now_ns)
+
+  awk -v name="$name" -v ns="$((end - start))" -v n="$iter" -v bytes="$bytes" \
+    'BEGIN { printf "%-24s %8.1f MB/s\n", name, bytes * n / (ns / 1e9) / 1e6 }'
+}
+
+src=tmp_bench.in # *.c はMakefileがビルド対象に含めてしまう
+gen_program 4000 > $src
+echo "input: $(wc -c < $src) bytes"
+
+bench "parse (-fsyntax-only)" 20 ./9cc $flags -fsyntax-only $src
+bench "compile" 20 ./9cc $flags $src
+
+echo "phases (-ftime-report):"
+./9cc $flags -ftime-report -o /dev/null $src
+
+sum=tmp_sum
+gen_array_sum > $sum.in
+./9cc $flags -o $sum.s $sum.in && cc -o $sum $sum.s || { echo "array sum: failed"; exit 1; }
+echo "generated code:"
+bench "array sum" 5 ./$sum
+
+# 関数ごとに解放する--streamで、関数の数に比例して増えていた
+# 構文木と中間表現の使用量が1関数分に収まることを確かめる
+gen_program 10000 > $src
+echo "memory (--mem-stats, $(wc -c < $src) bytes):"
+for mode in "" --stream; do
+  echo "${mode:-default}:"
+  ./9cc $flags $mode --mem-stats -o /dev/null $src 2>&1 | grep -E "^(ast|ir|max rss)"
+done
+
+# トークナイザだけの速さ。SIMD版とスカラー版を比べる
+echo "tokenizer (--lex-only):"
+for gen in gen_program gen_indented_program; do
+  $gen 20000 > $src
+  bytes=$(wc -c < $src)
+  echo "$gen ($bytes bytes):"
+  bench_mbps "  simd" "$bytes" 10 ./9cc $flags --lex-only $src
+  bench_mbps "  scalar (--no-simd)" "$bytes" 10 ./9cc $flags --no-simd --lex-only $src
+done
@@ -1,311 +1,609 @@
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
 #include "9cc.h"
 
 char *argreg1[] = {"dil", "sil", "dl", "cl", "r8b", "r9b"};
+char *argreg4[] = {"edi", "esi", "edx", "ecx", "r8d", "r9d"};
 char *argreg8[] = {"rdi", "rsi", "rdx", "rcx", "r8", "r9"};
 static Function *current_fn;
-static void gen(Node *node);
 
 int align_to(int n, int align)
 {
     return (n + align - 1) & ~(align - 1);
 }
 
+// アラインメントの大きい順に並べ替える (安定)。
+// 大きいものから詰めると、間に埋め草がほとんど入らない。
+static VarList *sort_by_align(VarList *list)
+{
+    VarList head = {};
+    for (VarList *vl = list, *next; vl; vl = next)
+    {
+        next = vl->next;
+        VarList *p = &head;
+        while (p->next && p->next->var->ty->align >= vl->var->ty->align)
+            p = p->next;
+        vl->next = p->next;
+        p->next = vl;
+    }
+    return head.next;
+}
+
 static void assign_lvar_offsets(Program *prog)
 {
     for (Function *fn = prog->fns; fn; fn = fn->next)
     {
+        fn->locals = sort_by_align(fn->locals);
         int offset = 0;
         for (VarList *vl = fn->locals; vl; vl = vl->next)
         {
             Var *var = vl->var;
-            offset += size_of(var->ty);
+            if (var->reg)
+                continue;
+            offset = align_to(offset + size_of(var->ty), var->ty->align);
             var->offset = offset;
         }
         fn->stack_size = align_to(offset, 8);
     }
 }
 
-void load(Type *ty)
+// -g: 文の行番号を.locで出力する。行が変わったときだけ出力する。
+static int last_line;
+
+static void emit_loc(int line_no)
 {
-    printf("  pop rax\n");
-    if (size_of(ty) == 1)
-        printf("  movsx rax, byte ptr [rax]\n");
-    else
-        printf("  mov rax, [rax]\n");
-    printf("  push rax\n");
+    if (!opt_debug || !line_no || line_no == last_line)
+        return;
+    emit("  .loc 1 %d\n", line_no);
+    last_line = line_no;
 }
 
-void store(Type *ty)
+void emit_data(Program *prog)
 {
-    printf("  pop rdi\n");
-    printf("  pop rax\n");
-    if (size_of(ty) == 1)
-        printf("  mov [rax], dil\n");
-    else
-        printf("  mov [rax], rdi\n");
-    printf("  push rdi\n");
+    emit(".data\n");
+
+    prog->globals = sort_by_align(prog->globals);
+    for (VarList *vl = prog->globals; vl; vl = vl->next)
+    {
+        Var *var = vl->var;
+        emit(".align %d\n", var->ty->align);
+        emit("%s:\n", var->name);
+        emit("  .zero %d\n", size_of(var->ty));
+    }
+}
+
+//
+// 中間表現からのコード生成
+//
+// 実レジスタに割り当てられた仮想レジスタはそのレジスタを、スタックに
+// 置かれたものはメモリを直接オペランドにする。x86の命令はメモリの
+// オペランドを1つしか取れないので、足りないときはrax/rdiを経由する。
+//
+
+static char *regs[] = {"rbx", "r12", "r13", "r14", "r15"};
+
+// 64ビットレジスタrの下位sizeバイトの名前
+static char *sub_reg(char *r, int size)
+{
+    static char *names[][3] = {
+        {"rax", "eax", "al"},
+        {"rdi", "edi", "dil"},
+        {"rbx", "ebx", "bl"},
+        {"r12", "r12d", "r12b"},
+        {"r13", "r13d", "r13b"},
+        {"r14", "r14d", "r14b"},
+        {"r15", "r15d", "r15b"},
+    };
+    if (size == 8)
+        return r;
+    for (int i = 0; i < sizeof(names) / sizeof(*names); i++)
+        if (!strcmp(names[i][0], r))
+            return names[i][size == 4 ? 1 : 2];
+    error("sub_reg: unknown register %s", r);
+    return NULL;
 }
 
-static int count(void)
+// スタックに置いた仮想レジスタのオペランド表記
+static char *slot(int offset)
 {
-    static int i = 1;
-    return i++;
+    int len = snprintf(NULL, 0, "qword ptr [rbp-%d]", offset);
+    char *buf = arena_alloc(&ir_arena, len + 1);
+    sprintf(buf, "qword ptr [rbp-%d]", offset);
+    return buf;
+}
+
+static char *opnd(Reg *r)
+{
+    if (r->rn >= 0)
+        return regs[r->rn];
+    if (!r->name)
+        r->name = slot(r->offset);
+    return r->name;
+}
+
+// rの値が入ったレジスタを返す。スタックにあればscratchに読み込む
+static char *use(Reg *r, char *scratch)
+{
+    if (r->rn >= 0)
+        return regs[r->rn];
+    if (strcmp(opnd(r), scratch))
+        emit_insn("mov", scratch, opnd(r));
+    return scratch;
+}
+
+// 結果をrに書き込むためのレジスタを返す。スタックに置くならscratchを使い、
+// 計算後にdef_done()でスタックに書き戻す
+static char *def(Reg *r, char *scratch)
+{
+    return r->rn >= 0 ? regs[r->rn] : scratch;
+}
+
+static void def_done(Reg *r, char *reg)
+{
+    if (r->rn < 0 && strcmp(opnd(r), reg))
+        emit_insn("mov", opnd(r), reg);
+}
+
+// スタックに置いた値でも、直後の命令がraxを経由して読むだけなら
+// スタックには書かず、raxに残したまま渡す。第1オペランド(アドレスの基点)と、
+// 変数への代入の値はどの命令もraxを経由して読む。
+static void keep_in_rax(IR *ir)
+{
+    Reg *r = ir->dst;
+    IR *next = ir->next;
+    if (!r || r->rn >= 0 || !next || r->last_use != r->def + 1)
+        return;
+    if ((next->a == r && next->b != r) ||
+        (next->kind == IR_STORE && !next->a && !next->idx && next->b == r))
+        r->name = "rax";
+}
+
+// 2項演算の右辺。即値が32ビットに収まらなければrdiに読み込む
+static char *rhs(IR *ir)
+{
+    if (ir->b)
+        return opnd(ir->b);
+    if (ir->imm != (int)ir->imm)
+    {
+        emit_insn("mov", "rdi", emit_opnd("%ld", ir->imm));
+        return "rdi";
+    }
+    return emit_opnd("%ld", ir->imm);
 }
 
-void gen_addr(Node *node)
+// IR_ADDR/IR_LOAD/IR_STOREのアドレスを、[]の中に書く形で返す。
+// 基点はrax、添字はrdxを経由して読む
+static char *addr(IR *ir)
 {
-    switch (node->kind)
+    char *idx = ir->idx ? use(ir->idx, "rdx") : NULL;
+    char *base;
+    long disp = ir->imm;
+
+    if (ir->a)
+        base = use(ir->a, "rax");
+    else if (ir->var->is_local)
     {
-    case ND_LVAR:
+        base = "rbp";
+        disp -= ir->var->offset;
+    }
+    else if (!idx)
+        return emit_opnd(disp < 0 ? "rip+%s%ld" : "rip+%s+%ld", ir->var->name, disp);
+    else
     {
-        Var *var = node->var;
-        if (var->is_local)
-        {
-            printf("  lea rax, [rbp-%d]\n", node->var->offset);
-            printf("  push rax\n");
-        }
-        else
-        {
-            printf("  lea rax, [rip+%s]\n", var->name);
-            printf("  push rax\n");
-        }
-        return;
+        // RIP相対には添字を付けられない
+        emit_insn("lea", "rax", emit_opnd("[rip+%s]", ir->var->name));
+        base = "rax";
     }
-    case ND_DEREF:
-        gen(node->lhs);
-        return;
-    default:
-        error("gen_addr: invalid node");
-        return;
+
+    char *s = base;
+    if (idx)
+        s = emit_opnd("%s+%s*%d", s, idx, ir->scale);
+    if (disp)
+        s = emit_opnd(disp < 0 ? "%s%ld" : "%s+%ld", s, disp);
+    return s;
+}
+
+// 2のべき乗ならその指数、そうでなければ-1
+static int log2_of(long val)
+{
+    if (val <= 0 || (val & (val - 1)))
+        return -1;
+    int k = 0;
+    while (val > 1)
+    {
+        val >>= 1;
+        k++;
     }
+    return k;
 }
 
-void gen_lval(Node *node)
+// 定数倍はシフトかleaにする
+static void gen_mul_imm(IR *ir)
 {
-    if (node->ty->kind == TY_ARRAY)
-        error("not an lvalue");
-    gen_addr(node);
+    long val = ir->imm;
+    int k = log2_of(val);
+    char *d = def(ir->dst, "rax");
+
+    if (val == 3 || val == 5 || val == 9)
+    {
+        char *a = use(ir->a, d);
+        emit_insn("lea", d, emit_opnd("[%s+%s*%ld]", a, a, val - 1));
+    }
+    else
+    {
+        if (strcmp(d, opnd(ir->a)))
+            emit_insn("mov", d, opnd(ir->a));
+        if (k > 0)
+            emit_insn("shl", d, emit_opnd("%d", k));
+        else if (k < 0)
+            emit_insn("imul", d, rhs(ir));
+    }
+    def_done(ir->dst, d);
 }
 
-void gen(Node *node)
+// 符号付き64ビット除算で、定数dで割る代わりに掛ける魔法数Mとシフト量s
+// (Hacker's Delight 10-4)。|d| >= 2 であること
+static void magic(long d, long *m, int *s)
 {
-    printf("# start gen node (type is %d)\n", node->kind);
-    switch (node->kind)
+    unsigned long two63 = 1UL << 63;
+    unsigned long ad = d < 0 ? -(unsigned long)d : d;
+    unsigned long t = two63 + ((unsigned long)d >> 63);
+    unsigned long anc = t - 1 - t % ad;
+    int p = 63;
+    unsigned long q1 = two63 / anc, r1 = two63 - q1 * anc;
+    unsigned long q2 = two63 / ad, r2 = two63 - q2 * ad;
+    unsigned long delta;
+    do
     {
-    case ND_NULL:
-        return;
-    case ND_NUM:
-        printf("  push %d\n", node->val);
-        return;
-    case ND_EXPR_STMT:
-        gen(node->lhs);
-        printf("  add rsp, 8\n");
-        return;
-    case ND_LVAR:
-        gen_addr(node);
-        if (node->ty->kind != TY_ARRAY)
-        {
-            load(node->ty);
-        }
-        return;
-    case ND_ADDR:
-        gen_addr(node->lhs);
-        return;
-    case ND_DEREF:
-        gen(node->lhs);
-        if (node->ty->kind != TY_ARRAY)
+        p++;
+        q1 *= 2;
+        r1 *= 2;
+        if (r1 >= anc)
         {
-            load(node->ty);
+            q1++;
+            r1 -= anc;
         }
-        return;
-    case ND_ASSIGN:
-        gen_lval(node->lhs);
-        gen(node->rhs);
-        store(node->ty);
-        return;
-    case ND_RETURN:
-        gen(node->lhs);
-        printf("  pop rax\n");
-        printf("  jmp .L.return.%s\n", current_fn->name);
-        return;
-    case ND_BLOCK:
-        for (int i = 0; node->body[i]; i++)
+        q2 *= 2;
+        r2 *= 2;
+        if (r2 >= ad)
         {
-            gen(node->body[i]);
+            q2++;
+            r2 -= ad;
         }
-        return;
-    case ND_IF:
+        delta = ad - r2;
+    } while (q1 < delta || (q1 == delta && r1 == 0));
+
+    *m = q2 + 1;
+    if (d < 0)
+        *m = -*m;
+    *s = p - 64;
+}
+
+// 定数での除算は、2のべき乗ならシフトに、それ以外は魔法数の乗算にする。
+// 結果はraxに置く
+static void gen_div_imm(IR *ir)
+{
+    long d = ir->imm;
+    long ad = d < 0 ? -d : d;
+    int k = log2_of(ad);
+
+    if (d == 0 || d == LONG_MIN || d != (int)d)
     {
-        int c = count();
-        gen(node->cond);
-        printf("  pop rax\n");
-        printf("  cmp rax, 0\n");
-        printf("  je  .L.else.%d\n", c);
-        gen(node->then);
-        printf("  jmp .L.end.%d\n", c);
-        printf(".L.else.%d:\n", c);
-        if (node->els)
-            gen(node->els);
-        printf(".L.end.%d:\n", c);
+        // 実行時の振る舞いに任せる
+        if (strcmp(opnd(ir->a), "rax"))
+            emit_insn("mov", "rax", opnd(ir->a));
+        emit_insn("mov", "rdi", emit_opnd("%ld", d));
+        emit_insn("cqo", NULL, NULL);
+        emit_insn("idiv", "rdi", NULL);
         return;
     }
-    case ND_FOR:
+
+    if (k >= 0)
     {
-        int c = count();
-        if (node->init)
-            gen(node->init);
-        printf(".L.begin.%d:\n", c);
-        if (node->cond)
+        // 負の数は0の方向に丸めるため、割る前に2^k-1を足す
+        if (strcmp(opnd(ir->a), "rax"))
+            emit_insn("mov", "rax", opnd(ir->a));
+        if (k > 0)
         {
-            gen(node->cond);
-            printf("  pop rax\n");
-            printf("  cmp rax, 0\n");
-            printf("  je  .L.end.%d\n", c);
+            emit_insn("mov", "rdx", "rax");
+            if (k > 1)
+                emit_insn("sar", "rdx", "63");
+            emit_insn("shr", "rdx", emit_opnd("%d", 64 - k));
+            emit_insn("add", "rax", "rdx");
+            emit_insn("sar", "rax", emit_opnd("%d", k));
         }
-        gen(node->then);
-        if (node->inc)
-            gen(node->inc);
-        printf("  jmp .L.begin.%d\n", c);
-        printf(".L.end.%d:\n", c);
+        if (d < 0)
+            emit_insn("neg", "rax", NULL);
         return;
     }
-    case ND_FUNCALL:
-    {
-        int nargs = 0;
-        while (node->args[nargs])
-        {
-            gen(node->args[nargs++]);
-        }
 
-        for (int i = nargs - 1; i >= 0; i--)
-        {
-            printf("  pop %s\n", argreg8[i]);
-        }
+    long m;
+    int s;
+    magic(d, &m, &s);
+    char *n = use(ir->a, "rdi");
+    emit_insn("mov", "rax", emit_opnd("%ld", m));
+    emit_insn("imul", n, NULL);
+    if (d > 0 && m < 0)
+        emit_insn("add", "rdx", n);
+    else if (d < 0 && m > 0)
+        emit_insn("sub", "rdx", n);
+    if (s > 0)
+        emit_insn("sar", "rdx", emit_opnd("%d", s));
+    // 商が負なら1を足して0の方向に丸める
+    emit_insn("mov", "rax", "rdx");
+    emit_insn("shr", "rax", "63");
+    emit_insn("add", "rax", "rdx");
+}
 
-        printf("  mov rax, 0\n");
-        printf("  call %s\n", node->funcname);
-        printf("  push rax\n");
-        return;
-    }
-    }
+static void gen_binop(IR *ir, char *op)
+{
+    char *d = def(ir->dst, "rax");
+    if (strcmp(d, opnd(ir->a)))
+        emit_insn("mov", d, opnd(ir->a));
+    emit_insn(op, d, rhs(ir));
+    def_done(ir->dst, d);
+}
 
-    gen(node->lhs);
-    gen(node->rhs);
+static void gen_cmp(IR *ir, char *set)
+{
+    char *a = use(ir->a, "rax");
+    emit_insn("cmp", a, rhs(ir));
+    emit_insn(set, "al", NULL);
+    char *d = def(ir->dst, "rax");
+    emit_insn("movzb", d, "al");
+    def_done(ir->dst, d);
+}
 
-    printf("  pop rdi\n");
-    printf("  pop rax\n");
+static char *jcc_true[] = {[IR_EQ] = "je", [IR_NE] = "jne", [IR_LT] = "jl", [IR_LE] = "jle"};
+static char *jcc_false[] = {[IR_EQ] = "jne", [IR_NE] = "je", [IR_LT] = "jge", [IR_LE] = "jg"};
 
-    switch (node->kind)
+// フラグを見てbb1かbb2へ分岐する。次に置かれるブロックへのジャンプは省く
+static void gen_branch(IR *ir, char *jtrue, char *jfalse, BB *next)
+{
+    if (ir->bb2 == next)
     {
-    case ND_ADD:
-        if (node->ty->base)
-            printf("  imul rdi, %d\n", size_of(node->ty->base));
-        printf("  add rax, rdi\n");
-        break;
-    case ND_SUB:
-        if (node->ty->base)
-            printf("  imul rdi, %d\n", size_of(node->ty->base));
-        printf("  sub rax, rdi\n");
-        break;
-    case ND_MUL:
-        printf("  imul rax, rdi\n");
-        break;
-    case ND_DIV:
-        printf("  cqo\n");
-        printf("  idiv rdi\n");
-        break;
-    case ND_EQ:
-        printf("  cmp rax, rdi\n");
-        printf("  sete al\n");
-        printf("  movzb rax, al\n");
-        break;
-    case ND_NE:
-        printf("  cmp rax, rdi\n");
-        printf("  setne al\n");
-        printf("  movzb rax, al\n");
-        break;
-    case ND_LT:
-        printf("  cmp rax, rdi\n");
-        printf("  setl al\n");
-        printf("  movzb rax, al\n");
-        break;
-    case ND_LE:
-        printf("  cmp rax, rdi\n");
-        printf("  setle al\n");
-        printf("  movzb rax, al\n");
-        break;
+        emit_insn(jtrue, emit_opnd(".L%d", ir->bb1->label), NULL);
+        return;
     }
-
-    printf("  push rax\n");
-    printf("# end gen node (type is %d)\n", node->kind);
+    emit_insn(jfalse, emit_opnd(".L%d", ir->bb2->label), NULL);
+    if (ir->bb1 != next)
+        emit_insn("jmp", emit_opnd(".L%d", ir->bb1->label), NULL);
 }
 
-void emit_data(Program *prog)
+// 使用するcallee-savedレジスタを保存する位置は、ローカル変数の下
+static int save_offset(Function *fn, int n)
 {
-    printf(".data\n");
+    return fn->stack_size + n * 8;
+}
 
-    for (VarList *vl = prog->globals; vl; vl = vl->next)
-    {
-        Var *var = vl->var;
-        printf("%s:\n", var->name);
-        printf("  .zero %d\n", size_of(var->ty));
-    }
+// callee-savedレジスタを戻してフレームを畳む
+static void epilogue(Function *fn)
+{
+    for (int i = 0, n = 0; i < NREG; i++)
+        if (fn->used_regs & (1 << i))
+            emit_insn("mov", regs[i], emit_opnd("[rbp-%d]", save_offset(fn, ++n)));
+    emit_insn("mov", "rsp", "rbp");
+    emit_insn("pop", "rbp", NULL);
 }
 
-void load_arg(Var *var, int idx)
+static void gen_ir_one(IR *ir, BB *next)
 {
-    int sz = size_of(var->ty);
-    if (sz == 1)
+    emit_loc(ir->line_no);
+
+    switch (ir->kind)
+    {
+    case IR_IMM:
+        emit_insn("mov", opnd(ir->dst), emit_opnd("%d", (int)ir->imm));
+        return;
+    case IR_ADDR:
     {
-        printf("  mov [rbp-%d], %s\n", var->offset, argreg1[idx]);
+        char *a = addr(ir);
+        char *d = def(ir->dst, "rax");
+        emit_insn("lea", d, emit_opnd("[%s]", a));
+        def_done(ir->dst, d);
+        return;
     }
-    else
+    case IR_LOAD:
+    {
+        char *a = addr(ir);
+        char *d = def(ir->dst, "rax");
+        if (ir->size == 1)
+            emit_insn("movsx", d, emit_opnd("byte ptr [%s]", a));
+        else if (ir->size == 4)
+            emit_insn("movsxd", d, emit_opnd("dword ptr [%s]", a));
+        else
+            emit_insn("mov", d, emit_opnd("[%s]", a));
+        def_done(ir->dst, d);
+        return;
+    }
+    case IR_STORE:
+    {
+        // 変数に書くならアドレスのためのレジスタが要らないので、値はraxに読む
+        char *a = addr(ir);
+        char *scratch = ir->a || ir->idx ? "rdi" : "rax";
+        emit_insn("mov", emit_opnd("[%s]", a), sub_reg(use(ir->b, scratch), ir->size));
+        return;
+    }
+    case IR_MOV:
+    {
+        char *d = opnd(ir->dst);
+        if (strcmp(d, opnd(ir->a)))
+            emit_insn("mov", d, opnd(ir->a));
+        if (ir->size == 4)
+            emit_insn("movsxd", d, sub_reg(d, 4));
+        return;
+    }
+    case IR_STORE_ARG:
+        // 呼び出し側は引数の型の幅しか値を設定しないので、レジスタに置く
+        // intの引数は符号拡張する
+        if (ir->var->reg && ir->size == 4)
+            emit_insn("movsxd", opnd(ir->var->reg), argreg4[ir->imm]);
+        else if (ir->var->reg)
+            emit_insn("mov", opnd(ir->var->reg), argreg8[ir->imm]);
+        else if (ir->size == 1)
+            emit_insn("mov", emit_opnd("[rbp-%d]", ir->var->offset), argreg1[ir->imm]);
+        else if (ir->size == 4)
+            emit_insn("mov", emit_opnd("[rbp-%d]", ir->var->offset), argreg4[ir->imm]);
+        else
+            emit_insn("mov", emit_opnd("[rbp-%d]", ir->var->offset), argreg8[ir->imm]);
+        return;
+    case IR_ADD:
+        gen_binop(ir, "add");
+        return;
+    case IR_SUB:
+        gen_binop(ir, "sub");
+        return;
+    case IR_MUL:
+        if (ir->b)
+            gen_binop(ir, "imul");
+        else
+            gen_mul_imm(ir);
+        return;
+    case IR_DIV:
+        if (ir->b)
+        {
+            if (strcmp(opnd(ir->a), "rax"))
+                emit_insn("mov", "rax", opnd(ir->a));
+            emit_insn("cqo", NULL, NULL);
+            emit_insn("idiv", opnd(ir->b), NULL);
+        }
+        else
+            gen_div_imm(ir);
+        if (strcmp(opnd(ir->dst), "rax"))
+            emit_insn("mov", opnd(ir->dst), "rax");
+        return;
+    case IR_EQ:
+        gen_cmp(ir, "sete");
+        return;
+    case IR_NE:
+        gen_cmp(ir, "setne");
+        return;
+    case IR_LT:
+        gen_cmp(ir, "setl");
+        return;
+    case IR_LE:
+        gen_cmp(ir, "setle");
+        return;
+    case IR_CALL:
+        // 割り当てに使うレジスタはすべてcallee-savedなので、呼び出しをまたいで値が残る
+        for (int i = 0; i < ir->nargs; i++)
+            emit_insn("mov", argreg8[i], opnd(ir->args[i]));
+        emit_insn("mov", "rax", "0");
+        emit_insn("call", ir->funcname, NULL);
+        // 戻り値は型の幅までしか設定されていないので符号拡張する
+        if (ir->size == 4)
+            emit_insn("movsxd", "rax", "eax");
+        else if (ir->size == 1)
+            emit_insn("movsx", "rax", "al");
+        if (strcmp(opnd(ir->dst), "rax"))
+            emit_insn("mov", opnd(ir->dst), "rax");
+        return;
+    case IR_TAILCALL:
+        for (int i = 0; i < ir->nargs; i++)
+            emit_insn("mov", argreg8[i], opnd(ir->args[i]));
+        // 自分自身の呼び出しは、引数を受け取るところへ戻るループになる
+        if (!strcmp(ir->funcname, current_fn->name))
+        {
+            emit_insn("jmp", emit_opnd(".L.entry.%s", current_fn->name), NULL);
+            return;
+        }
+        epilogue(current_fn);
+        emit_insn("mov", "rax", "0");
+        emit_insn("jmp", ir->funcname, NULL);
+        return;
+    case IR_JMP:
+        if (ir->bb1 != next)
+            emit_insn("jmp", emit_opnd(".L%d", ir->bb1->label), NULL);
+        return;
+    case IR_BR:
+        emit_insn("cmp", use(ir->a, "rax"), "0");
+        gen_branch(ir, "jne", "je", next);
+        return;
+    case IR_BR_CMP:
     {
-        assert(sz == 8);
-        printf("  mov [rbp-%d], %s\n", var->offset, argreg8[idx]);
+        char *a = use(ir->a, "rax");
+        emit_insn("cmp", a, rhs(ir));
+        gen_branch(ir, jcc_true[ir->cond], jcc_false[ir->cond], next);
+        return;
+    }
+    case IR_RETURN:
+        if (strcmp(opnd(ir->a), "rax"))
+            emit_insn("mov", "rax", opnd(ir->a));
+        emit_insn("jmp", emit_opnd(".L.return.%s", current_fn->name), NULL);
+        return;
     }
 }
 
 void emit_text(Program *prog)
 {
-    printf(".text\n");
+    emit(".text\n");
 
     for (Function *fn = prog->fns; fn; fn = fn->next)
     {
-        printf(".global %s\n", fn->name);
-        printf("%s:\n", fn->name);
+        emit(".global %s\n", fn->name);
+        emit("%s:\n", fn->name);
+        emit_function_begin();
         current_fn = fn;
+        last_line = 0;
         log_function(fn);
 
-        // プロローグ
-        printf("  push rbp\n");
-        printf("  mov rbp, rsp\n");
-        printf("  sub rsp, %d\n", fn->stack_size);
+        int nsave = 0;
+        for (int i = 0; i < NREG; i++)
+            if (fn->used_regs & (1 << i))
+                nsave++;
+        int stack_size = align_to(save_offset(fn, nsave), 16);
 
-        int i = 0;
-        for (VarList *vl = fn->params; vl; vl = vl->next)
-        {
-            load_arg(vl->var, i++);
-        }
+        // プロローグ
+        emit_insn("push", "rbp", NULL);
+        emit_insn("mov", "rbp", "rsp");
+        emit_insn("sub", "rsp", emit_opnd("%d", stack_size));
+        for (int i = 0, n = 0; i < NREG; i++)
+            if (fn->used_regs & (1 << i))
+                emit_insn("mov", emit_opnd("[rbp-%d]", save_offset(fn, ++n)), regs[i]);
+        emit_label(emit_opnd(".L.entry.%s", fn->name));
 
-        for (int i = 0; fn->body[i]; i++)
+        for (BB *bb = fn->bbs; bb; bb = bb->next)
         {
-            gen(fn->body[i]);
+            emit_label(emit_opnd(".L%d", bb->label));
+            for (IR *ir = bb->ir; ir; ir = ir->next)
+            {
+                keep_in_rax(ir);
+                gen_ir_one(ir, bb->next);
+            }
         }
 
         // エピローグ
-        printf(".L.return.%s:\n", fn->name);
-        printf("  mov rsp, rbp\n");
-        printf("  pop rbp\n");
-        printf("  ret\n");
+        emit_label(emit_opnd(".L.return.%s", fn->name));
+        epilogue(fn);
+        emit_insn("ret", NULL, NULL);
+        emit_function_end();
     }
 }
 
-void codegen(Program *prog)
+void codegen_begin()
+{
+    emit(".intel_syntax noprefix\n");
+    if (opt_debug)
+        emit(".file 1 \"%s\"\n", filename);
+}
+
+void codegen_data(Program *prog)
 {
-    log("Start codegen:");
-    assign_lvar_offsets(prog);
-    printf(".intel_syntax noprefix\n");
     emit_data(prog);
+}
+
+void codegen_text(Program *prog)
+{
+    assign_lvar_offsets(prog);
+    alloc_regs(prog);
     emit_text(prog);
 }
+
+void codegen(Program *prog)
+{
+    log("Start codegen:");
+    codegen_begin();
+    codegen_data(prog);
+    codegen_text(prog);
+}
@@ -0,0 +1,217 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "9cc.h"
+
+// アセンブリの出力バッファ。
+// 命令ごとにprintfで書式を解釈して出力する代わりに、生成したテキストを
+// ここに連結していき、コード生成の最後に1回のwriteでまとめて書き出す。
+// --streamでは関数1つごとに書き出す。
+
+static char *buf;
+static size_t len;
+static size_t cap;
+
+static void reserve(size_t n)
+{
+    if (len + n <= cap)
+        return;
+    while (len + n > cap)
+        cap = cap ? cap * 2 : 1 << 20;
+    buf = realloc(buf, cap);
+    if (!buf)
+        error("メモリを確保できません");
+}
+
+static void emit_str(char *s, size_t n)
+{
+    reserve(n);
+    memcpy(buf + len, s, n);
+    len += n;
+}
+
+// 整数を10進数で書き出す。オフセットやラベル番号の出力に使う。
+static void emit_int(long val)
+{
+    char tmp[24];
+    char *p = tmp + sizeof(tmp);
+    unsigned long u = val < 0 ? -(unsigned long)val : val;
+    do
+    {
+        *--p = '0' + u % 10;
+        u /= 10;
+    } while (u);
+    if (val < 0)
+        *--p = '-';
+    emit_str(p, tmp + sizeof(tmp) - p);
+}
+
+static void vemit(char *fmt, va_list ap)
+{
+    char *p = fmt;
+    for (;;)
+    {
+        char *q = strchr(p, '%');
+        if (!q)
+        {
+            emit_str(p, strlen(p));
+            break;
+        }
+        emit_str(p, q - p);
+
+        switch (q[1])
+        {
+        case 's':
+        {
+            char *s = va_arg(ap, char *);
+            emit_str(s, strlen(s));
+            break;
+        }
+        case 'd':
+            emit_int(va_arg(ap, int));
+            break;
+        case 'l':
+            if (q[2] != 'd')
+                error("emit: unsupported format: %s", fmt);
+            emit_int(va_arg(ap, long));
+            q++;
+            break;
+        case '%':
+            emit_str("%", 1);
+            break;
+        default:
+            error("emit: unsupported format: %s", fmt);
+        }
+        p = q + 2;
+    }
+}
+
+// 関数の中では、命令を覗き穴最適化のために記録しておき、
+// 関数の終わりでまとめて出力する
+static bool recording;
+
+// emit_opndで作った文字列の置き場所。関数ごとに空にする
+static Arena opnd_arena = {"operands"};
+
+// printfと同じ要領で出力する。ただし解釈するのは%s, %d, %ld, %%だけ。
+void emit(char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    size_t start = len;
+    vemit(fmt, ap);
+    va_end(ap);
+
+    if (recording)
+    {
+        reserve(1);
+        buf[len] = '\0';
+        peephole_directive(buf + start);
+        len = start;
+    }
+}
+
+// emitと同じ書式で文字列を作る。命令のオペランドを組み立てるのに使う。
+char *emit_opnd(char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    size_t start = len;
+    vemit(fmt, ap);
+    va_end(ap);
+
+    char *s = arena_strndup(&opnd_arena, buf + start, len - start);
+    len = start;
+    return s;
+}
+
+// 命令を1つ出力する。dstとsrcはオペランドがなければNULL。
+void emit_insn(char *op, char *dst, char *src)
+{
+    if (recording)
+    {
+        peephole_insn(op, dst, src);
+        return;
+    }
+    emit_str("  ", 2);
+    emit_str(op, strlen(op));
+    if (dst)
+    {
+        emit_str(" ", 1);
+        emit_str(dst, strlen(dst));
+    }
+    if (src)
+    {
+        emit_str(", ", 2);
+        emit_str(src, strlen(src));
+    }
+    emit_str("\n", 1);
+}
+
+void emit_label(char *name)
+{
+    if (recording)
+    {
+        peephole_label(name);
+        return;
+    }
+    emit_str(name, strlen(name));
+    emit_str(":\n", 2);
+}
+
+void emit_function_begin()
+{
+    recording = !opt_no_peephole;
+}
+
+// 記録した関数1つ分の命令を覗き穴最適化にかけて出力する
+void emit_function_end()
+{
+    if (recording)
+    {
+        recording = false;
+        peephole_flush();
+    }
+    arena_reset(&opnd_arena);
+}
+
+static int fd = -1;
+
+// バッファの内容をpathに書き出す。pathがNULLか"-"なら標準出力に書く。
+// 2回目以降は、最初に開いたファイルの続きに書く。
+void emit_flush(char *path)
+{
+    if (fd < 0)
+    {
+        fd = STDOUT_FILENO;
+        if (path && strcmp(path, "-"))
+        {
+            fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (fd < 0)
+                error("%s を開けません: %s", path, strerror(errno));
+        }
+    }
+
+    for (size_t off = 0; off < len;)
+    {
+        ssize_t n = write(fd, buf + off, len - off);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            error("出力を書き込めません: %s", strerror(errno));
+        }
+        off += n;
+    }
+    len = 0;
+}
+
+void emit_close()
+{
+    if (fd >= 0 && fd != STDOUT_FILENO)
+        close(fd);
+    fd = -1;
+}
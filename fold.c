@@ -0,0 +1,230 @@
+#include <limits.h>
+#include "9cc.h"
+
+// 定数畳み込み。
+// パースの後に呼ばれ、値がコンパイル時に決まる部分木をND_NUMに置き換える。
+// また副作用のない式についての恒等式(x+0, x*1, x*0など)を簡約し、
+// 条件が定数のifとforを取り除く。
+
+static void fold(Node *node);
+
+static bool is_num(Node *node, int val)
+{
+    return node->kind == ND_NUM && node->val == val;
+}
+
+// nodeの評価が代入や関数呼び出しを含むならtrue
+static bool has_side_effects(Node *node)
+{
+    switch (node->kind)
+    {
+    case ND_NUM:
+    case ND_LVAR:
+        return false;
+    case ND_ASSIGN:
+    case ND_FUNCALL:
+        return true;
+    case ND_ADDR:
+    case ND_DEREF:
+        return has_side_effects(node->lhs);
+    default:
+        return has_side_effects(node->lhs) || has_side_effects(node->rhs);
+    }
+}
+
+// nodeをwithで置き換える。文の連結と行番号はnodeのものを引き継ぐ。
+static void replace(Node *node, Node *with)
+{
+    Node *next = node->next;
+    int line_no = node->line_no;
+    *node = *with;
+    node->next = next;
+    node->line_no = line_no;
+}
+
+static void replace_num(Node *node, long val)
+{
+    Type *ty = node->ty;
+    Node *next = node->next;
+    int line_no = node->line_no;
+    *node = (Node){.kind = ND_NUM, .line_no = line_no, .next = next, .ty = ty};
+    node->val = val;
+}
+
+// 両辺が定数の二項演算を計算する。結果がintに収まらない場合や
+// ゼロ除算のように実行時の振る舞いに任せるべき場合はfalseを返す。
+static bool eval_binary(NodeKind kind, long l, long r, long *val)
+{
+    switch (kind)
+    {
+    case ND_ADD:
+        *val = l + r;
+        break;
+    case ND_SUB:
+        *val = l - r;
+        break;
+    case ND_MUL:
+        *val = l * r;
+        break;
+    case ND_DIV:
+        if (r == 0)
+            return false;
+        *val = l / r;
+        break;
+    case ND_EQ:
+        *val = l == r;
+        break;
+    case ND_NE:
+        *val = l != r;
+        break;
+    case ND_LT:
+        *val = l < r;
+        break;
+    case ND_LE:
+        *val = l <= r;
+        break;
+    default:
+        return false;
+    }
+    return INT_MIN <= *val && *val <= INT_MAX;
+}
+
+static void fold_binary(Node *node)
+{
+    Node *lhs = node->lhs;
+    Node *rhs = node->rhs;
+
+    // ポインタの加減算はスケールが掛かるので対象外
+    if ((node->kind == ND_ADD || node->kind == ND_SUB) && node->ty->base)
+    {
+        if (is_num(rhs, 0))
+            replace(node, lhs);
+        return;
+    }
+
+    long val;
+    if (lhs->kind == ND_NUM && rhs->kind == ND_NUM &&
+        eval_binary(node->kind, lhs->val, rhs->val, &val))
+    {
+        replace_num(node, val);
+        return;
+    }
+
+    switch (node->kind)
+    {
+    case ND_ADD:
+        if (is_num(rhs, 0))
+            replace(node, lhs);
+        else if (is_num(lhs, 0))
+            replace(node, rhs);
+        return;
+    case ND_SUB:
+        if (is_num(rhs, 0))
+            replace(node, lhs);
+        return;
+    case ND_MUL:
+        if (is_num(rhs, 1))
+            replace(node, lhs);
+        else if (is_num(lhs, 1))
+            replace(node, rhs);
+        else if ((is_num(rhs, 0) && !has_side_effects(lhs)) ||
+                 (is_num(lhs, 0) && !has_side_effects(rhs)))
+            replace_num(node, 0);
+        return;
+    case ND_DIV:
+        if (is_num(rhs, 1))
+            replace(node, lhs);
+        return;
+    default:
+        break;
+    }
+}
+
+static void fold_stmt_list(Node *body)
+{
+    for (Node *n = body; n; n = n->next)
+        fold(n);
+}
+
+static void fold(Node *node)
+{
+    if (!node)
+        return;
+
+    switch (node->kind)
+    {
+    case ND_NUM:
+    case ND_LVAR:
+    case ND_NULL:
+        return;
+    case ND_BLOCK:
+        fold_stmt_list(node->body);
+        return;
+    case ND_FUNCALL:
+        fold_stmt_list(node->args);
+        return;
+    case ND_IF:
+        fold(node->cond);
+        fold(node->then);
+        fold(node->els);
+        if (node->cond->kind == ND_NUM)
+        {
+            Node *taken = node->cond->val ? node->then : node->els;
+            if (taken)
+                replace(node, taken);
+            else
+                replace(node, &(Node){.kind = ND_NULL});
+        }
+        return;
+    case ND_FOR:
+        fold(node->init);
+        fold(node->cond);
+        fold(node->inc);
+        fold(node->then);
+        if (node->cond && node->cond->kind == ND_NUM)
+        {
+            if (node->cond->val)
+            {
+                // for (;;) と同じ
+                node->cond = NULL;
+            }
+            else if (node->init)
+            {
+                // 本体は実行されないが、初期化式は評価する
+                replace(node, &(Node){.kind = ND_EXPR_STMT, .lhs = node->init});
+            }
+            else
+            {
+                replace(node, &(Node){.kind = ND_NULL});
+            }
+        }
+        return;
+    case ND_RETURN:
+    case ND_EXPR_STMT:
+    case ND_ADDR:
+    case ND_DEREF:
+        fold(node->lhs);
+        return;
+    case ND_ASSIGN:
+        fold(node->lhs);
+        fold(node->rhs);
+        return;
+    default:
+        fold(node->lhs);
+        fold(node->rhs);
+        fold_binary(node);
+        return;
+    }
+}
+
+// 他の最適化で書き換えた文を畳み込み直す
+void fold_stmt(Node *node)
+{
+    fold(node);
+}
+
+void fold_constants(Program *prog)
+{
+    for (Function *fn = prog->fns; fn; fn = fn->next)
+        fold_stmt_list(fn->body);
+}
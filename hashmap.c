@@ -0,0 +1,159 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "9cc.h"
+
+// 文字列のインターンと、インターン済みの文字列をキーにするハッシュマップ。
+// どちらもオープンアドレス法(線形探索)で実装する。
+
+#define INIT_CAPACITY 64
+#define MAX_LOAD 70 // 使用率(%)がこれを超えたら容量を2倍にする
+
+static uint32_t fnv_hash(char *s, int len)
+{
+    uint32_t hash = 2166136261;
+    for (int i = 0; i < len; i++)
+    {
+        hash ^= (unsigned char)s[i];
+        hash *= 16777619;
+    }
+    return hash;
+}
+
+//
+// Interning
+//
+
+typedef struct
+{
+    char *str;
+    int len;
+    uint32_t hash;
+} InternEntry;
+
+static InternEntry *strings;
+static int strings_cap;
+static int strings_used;
+
+static void intern_grow()
+{
+    int cap = strings_cap ? strings_cap * 2 : INIT_CAPACITY;
+    InternEntry *buf = calloc(cap, sizeof(InternEntry));
+
+    for (int i = 0; i < strings_cap; i++)
+    {
+        InternEntry *ent = &strings[i];
+        if (!ent->str)
+            continue;
+        for (uint32_t j = ent->hash & (cap - 1);; j = (j + 1) & (cap - 1))
+        {
+            if (!buf[j].str)
+            {
+                buf[j] = *ent;
+                break;
+            }
+        }
+    }
+
+    free(strings);
+    strings = buf;
+    strings_cap = cap;
+}
+
+// sからlenバイトの文字列と等しい、唯一のNUL終端文字列を返す。
+// 返された文字列同士はポインタの比較で等値判定できる。
+char *intern(char *s, int len)
+{
+    if ((strings_used + 1) * 100 >= strings_cap * MAX_LOAD)
+        intern_grow();
+
+    uint32_t hash = fnv_hash(s, len);
+    for (uint32_t i = hash & (strings_cap - 1);; i = (i + 1) & (strings_cap - 1))
+    {
+        InternEntry *ent = &strings[i];
+        if (!ent->str)
+        {
+            ent->str = arena_strndup(&symbol_arena, s, len);
+            ent->len = len;
+            ent->hash = hash;
+            strings_used++;
+            return ent->str;
+        }
+        if (ent->hash == hash && ent->len == len && !memcmp(ent->str, s, len))
+            return ent->str;
+    }
+}
+
+//
+// HashMap
+//
+
+static uint32_t ptr_hash(void *p)
+{
+    uint64_t x = (uintptr_t)p;
+    return (x * 0x9E3779B97F4A7C15ull) >> 32;
+}
+
+static void hashmap_grow(HashMap *map)
+{
+    int cap = map->capacity ? map->capacity * 2 : INIT_CAPACITY;
+    HashEntry *buf = calloc(cap, sizeof(HashEntry));
+
+    for (int i = 0; i < map->capacity; i++)
+    {
+        HashEntry *ent = &map->buckets[i];
+        if (!ent->key)
+            continue;
+        for (uint32_t j = ptr_hash(ent->key) & (cap - 1);; j = (j + 1) & (cap - 1))
+        {
+            if (!buf[j].key)
+            {
+                buf[j] = *ent;
+                break;
+            }
+        }
+    }
+
+    free(map->buckets);
+    map->buckets = buf;
+    map->capacity = cap;
+}
+
+// keyはintern()で得た文字列でなければならない
+void *hashmap_get(HashMap *map, char *key)
+{
+    if (!map->buckets)
+        return NULL;
+
+    for (uint32_t i = ptr_hash(key) & (map->capacity - 1);; i = (i + 1) & (map->capacity - 1))
+    {
+        HashEntry *ent = &map->buckets[i];
+        if (ent->key == key)
+            return ent->val;
+        if (!ent->key)
+            return NULL;
+    }
+}
+
+void hashmap_put(HashMap *map, char *key, void *val)
+{
+    if ((map->used + 1) * 100 >= map->capacity * MAX_LOAD)
+        hashmap_grow(map);
+
+    for (uint32_t i = ptr_hash(key) & (map->capacity - 1);; i = (i + 1) & (map->capacity - 1))
+    {
+        HashEntry *ent = &map->buckets[i];
+        if (ent->key == key)
+        {
+            ent->val = val;
+            return;
+        }
+        if (!ent->key)
+        {
+            ent->key = key;
+            ent->val = val;
+            map->used++;
+            return;
+        }
+    }
+}
@@ -0,0 +1,320 @@
+#include "9cc.h"
+
+// 関数のインライン展開。
+// 定数畳み込みの後に呼ばれ、同じファイルで定義された小さな関数の呼び出しを、
+// 本体の複製(ND_INLINE)に置き換える。呼び出される側を先に処理するので、
+// 展開する本体は展開済みのものになる。展開中の関数を再び呼ぶ呼び出し
+// (再帰)は展開しない。
+//
+// ND_INLINEのlhsは、引数を新しいローカル変数に代入する文と本体を並べた
+// ブロック、rhsは戻り値を受け取る変数。本体のreturnは、戻り値の変数への
+// 代入に書き換えたうえで、ND_INLINEの直後へ抜ける文として残す。
+
+typedef enum
+{
+    UNVISITED,
+    VISITING,
+    DONE,
+} State;
+
+typedef struct
+{
+    Function *fn;
+    State state;
+    int size; // 本体のノード数
+} FnInfo;
+
+static HashMap fn_info;
+static Function *caller; // 展開先の関数
+
+static int count_nodes(Node *node);
+
+static int count_list(Node *node)
+{
+    int n = 0;
+    for (; node; node = node->next)
+        n += count_nodes(node);
+    return n;
+}
+
+static int count_nodes(Node *node)
+{
+    if (!node)
+        return 0;
+
+    switch (node->kind)
+    {
+    case ND_NUM:
+    case ND_LVAR:
+    case ND_NULL:
+        return 1;
+    case ND_BLOCK:
+        return 1 + count_list(node->body);
+    case ND_FUNCALL:
+        return 1 + count_list(node->args);
+    case ND_IF:
+    case ND_FOR:
+        return 1 + count_nodes(node->cond) + count_nodes(node->then) + count_nodes(node->els) +
+               count_nodes(node->init) + count_nodes(node->inc);
+    default:
+        return 1 + count_nodes(node->lhs) + count_nodes(node->rhs);
+    }
+}
+
+//
+// 本体の複製
+//
+
+// 呼び出される側のローカル変数と、展開先に作った変数の対応
+typedef struct
+{
+    Var **from;
+    Var **to;
+    int len;
+    Node *ret; // 戻り値を受け取る変数
+    int depth; // 本体の中で展開済みのND_INLINEの深さ
+} Clone;
+
+static Node *make_node(NodeKind kind, Node *lhs, Node *rhs, Type *ty, int line_no)
+{
+    Node *node = arena_alloc(&node_arena, sizeof(Node));
+    node->kind = kind;
+    node->lhs = lhs;
+    node->rhs = rhs;
+    node->ty = ty;
+    node->line_no = line_no;
+    return node;
+}
+
+// 展開先の関数に新しいローカル変数を作る
+static Var *new_local(char *name, Type *ty)
+{
+    Var *var = arena_alloc(&node_arena, sizeof(Var));
+    var->name = name;
+    var->ty = ty;
+    var->is_local = true;
+
+    VarList *vl = arena_alloc(&node_arena, sizeof(VarList));
+    vl->var = var;
+    vl->next = caller->locals;
+    caller->locals = vl;
+    return var;
+}
+
+static Node *new_lvar(Var *var, int line_no)
+{
+    Node *node = make_node(ND_LVAR, NULL, NULL, var->ty, line_no);
+    node->var = var;
+    return node;
+}
+
+static Var *map_var(Clone *c, Var *var)
+{
+    for (int i = 0; i < c->len; i++)
+        if (c->from[i] == var)
+            return c->to[i];
+    return var; // グローバル変数
+}
+
+static Node *clone(Clone *c, Node *node);
+
+static Node *clone_list(Clone *c, Node *node)
+{
+    Node head = {};
+    Node *cur = &head;
+    for (; node; node = node->next)
+        cur = cur->next = clone(c, node);
+    return head.next;
+}
+
+static Node *clone(Clone *c, Node *node)
+{
+    if (!node)
+        return NULL;
+
+    Node *n = arena_alloc(&node_arena, sizeof(Node));
+    *n = *node;
+    n->next = NULL;
+
+    switch (node->kind)
+    {
+    case ND_NUM:
+    case ND_NULL:
+        break;
+    case ND_LVAR:
+        n->var = map_var(c, node->var);
+        break;
+    case ND_BLOCK:
+        n->body = clone_list(c, node->body);
+        break;
+    case ND_FUNCALL:
+        n->args = clone_list(c, node->args);
+        break;
+    case ND_IF:
+    case ND_FOR:
+        n->cond = clone(c, node->cond);
+        n->then = clone(c, node->then);
+        n->els = clone(c, node->els);
+        n->init = clone(c, node->init);
+        n->inc = clone(c, node->inc);
+        break;
+    case ND_RETURN:
+    {
+        // return e; は 戻り値の変数 = e; に置き換えてから抜ける。
+        // 展開済みの本体の中のreturnは、すでにその展開のものになっている
+        n->lhs = clone(c, node->lhs);
+        if (c->depth == 0)
+            n->lhs = make_node(ND_ASSIGN, c->ret, n->lhs, c->ret->ty, node->line_no);
+        break;
+    }
+    case ND_INLINE:
+        c->depth++;
+        n->lhs = clone(c, node->lhs);
+        c->depth--;
+        n->rhs = clone(c, node->rhs);
+        break;
+    default:
+        n->lhs = clone(c, node->lhs);
+        n->rhs = clone(c, node->rhs);
+        break;
+    }
+    return n;
+}
+
+// 呼び出しnodeを、calleeの本体を展開したND_INLINEに書き換える
+static void expand(Node *node, Function *callee)
+{
+    int nlocals = 0;
+    for (VarList *vl = callee->locals; vl; vl = vl->next)
+        nlocals++;
+
+    Clone c = {};
+    c.from = arena_alloc(&node_arena, sizeof(Var *) * nlocals);
+    c.to = arena_alloc(&node_arena, sizeof(Var *) * nlocals);
+    for (VarList *vl = callee->locals; vl; vl = vl->next)
+    {
+        c.from[c.len] = vl->var;
+        c.to[c.len++] = new_local(vl->var->name, vl->var->ty);
+    }
+    c.ret = new_lvar(new_local(callee->name, callee->ty), node->line_no);
+
+    // 引数を順に評価して仮引数の変数に代入する
+    Node head = {};
+    Node *cur = &head;
+    Node *arg = node->args;
+    for (VarList *vl = callee->params; vl; vl = vl->next, arg = arg->next)
+    {
+        Node *param = new_lvar(map_var(&c, vl->var), node->line_no);
+        Node *assign = make_node(ND_ASSIGN, param, arg, param->ty, node->line_no);
+        cur = cur->next = make_node(ND_EXPR_STMT, assign, NULL, NULL, node->line_no);
+    }
+    cur->next = clone_list(&c, callee->body);
+
+    Node *block = make_node(ND_BLOCK, NULL, NULL, NULL, node->line_no);
+    block->body = head.next;
+
+    Node *next = node->next;
+    Type *ty = node->ty;
+    int line_no = node->line_no;
+    *node = (Node){.kind = ND_INLINE, .line_no = line_no, .next = next, .ty = ty};
+    node->lhs = block;
+    node->rhs = c.ret;
+}
+
+//
+// 呼び出しの走査
+//
+
+static void visit_fn(FnInfo *info);
+
+static void walk(Node *node);
+
+static void walk_list(Node *node)
+{
+    for (; node; node = node->next)
+        walk(node);
+}
+
+static bool can_inline(FnInfo *info, Node *call)
+{
+    if (!info || info->state != DONE || info->size > opt_inline_limit)
+        return false;
+
+    // 引数の個数が合わない呼び出しはそのまま残す
+    int nparams = 0, nargs = 0;
+    for (VarList *vl = info->fn->params; vl; vl = vl->next)
+        nparams++;
+    for (Node *arg = call->args; arg; arg = arg->next)
+        nargs++;
+    return nparams == nargs;
+}
+
+static void walk(Node *node)
+{
+    if (!node)
+        return;
+
+    switch (node->kind)
+    {
+    case ND_NUM:
+    case ND_LVAR:
+    case ND_NULL:
+        return;
+    case ND_BLOCK:
+        walk_list(node->body);
+        return;
+    case ND_FUNCALL:
+    {
+        walk_list(node->args);
+        FnInfo *info = hashmap_get(&fn_info, node->funcname);
+        if (info && info->state == UNVISITED)
+            visit_fn(info);
+        // 処理中(VISITING)の関数は再帰呼び出しなので展開しない
+        if (can_inline(info, node))
+            expand(node, info->fn);
+        return;
+    }
+    case ND_IF:
+    case ND_FOR:
+        walk(node->cond);
+        walk(node->then);
+        walk(node->els);
+        walk(node->init);
+        walk(node->inc);
+        return;
+    default:
+        walk(node->lhs);
+        walk(node->rhs);
+        return;
+    }
+}
+
+static void visit_fn(FnInfo *info)
+{
+    Function *saved = caller;
+    caller = info->fn;
+    info->state = VISITING;
+    walk_list(info->fn->body);
+    info->size = count_list(info->fn->body);
+    info->state = DONE;
+    caller = saved;
+}
+
+void inline_functions(Program *prog)
+{
+    if (opt_inline_limit <= 0)
+        return;
+
+    for (Function *fn = prog->fns; fn; fn = fn->next)
+    {
+        FnInfo *info = arena_alloc(&node_arena, sizeof(FnInfo));
+        info->fn = fn;
+        hashmap_put(&fn_info, fn->name, info);
+    }
+    for (Function *fn = prog->fns; fn; fn = fn->next)
+    {
+        FnInfo *info = hashmap_get(&fn_info, fn->name);
+        if (info->state == UNVISITED)
+            visit_fn(info);
+    }
+}
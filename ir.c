@@ -0,0 +1,779 @@
+#include <stdio.h>
+#include "9cc.h"
+
+// 中間表現への変換。
+// ローカル変数はメモリか変数専用のレジスタに置き、式の途中の値だけを
+// 仮想レジスタに置く。式の途中で基本ブロックが分かれるのはインライン展開
+// した本体だけで、その中のループに入る前に定義された値は、ループを抜けた
+// 後で使われる。そのため命令を並べた順序のまま生存区間を求めればよい。
+
+static Function *fn;
+static BB *out; // 命令を追加している基本ブロック
+
+// 展開中のインライン関数。本体のreturnはendへ抜ける。
+// 関数のreturnの値そのものを展開したもの(tail)なら、本体のreturnは
+// そのまま関数からのreturnにする
+typedef struct Inline Inline;
+struct Inline
+{
+    Inline *prev;
+    BB *end;
+    bool tail;
+};
+static Inline *inl;
+static int nlabel;
+static int line_no;
+
+static BB *new_bb()
+{
+    BB *bb = arena_alloc(&ir_arena, sizeof(BB));
+    bb->label = ++nlabel;
+    return bb;
+}
+
+// bbを関数の末尾に置き、以降の命令の追加先にする
+static void start_bb(BB *bb)
+{
+    out->next = bb;
+    out = bb;
+}
+
+static IR *new_ir(IRKind kind)
+{
+    IR *ir = arena_alloc(&ir_arena, sizeof(IR));
+    ir->kind = kind;
+    ir->line_no = line_no;
+    if (out->last)
+        out->last->next = ir;
+    else
+        out->ir = ir;
+    out->last = ir;
+    return ir;
+}
+
+static Reg *new_reg()
+{
+    Reg *r = arena_alloc(&ir_arena, sizeof(Reg));
+    r->vn = ++fn->nregs;
+    r->rn = -1;
+    return r;
+}
+
+static Reg *imm(long val)
+{
+    IR *ir = new_ir(IR_IMM);
+    ir->dst = new_reg();
+    ir->imm = val;
+    return ir->dst;
+}
+
+static Reg *binop(IRKind kind, Reg *a, Reg *b)
+{
+    IR *ir = new_ir(kind);
+    ir->dst = new_reg();
+    ir->a = a;
+    ir->b = b;
+    return ir->dst;
+}
+
+// 右辺が定数なら、レジスタに置かずに命令に埋め込む
+static Reg *binop_imm(IRKind kind, Reg *a, long val)
+{
+    IR *ir = new_ir(kind);
+    ir->dst = new_reg();
+    ir->a = a;
+    ir->imm = val;
+    return ir->dst;
+}
+
+static void jmp(BB *bb)
+{
+    IR *ir = new_ir(IR_JMP);
+    ir->bb1 = bb;
+}
+
+static void br(Reg *cond, BB *then, BB *els)
+{
+    IR *ir = new_ir(IR_BR);
+    ir->a = cond;
+    ir->bb1 = then;
+    ir->bb2 = els;
+}
+
+static Reg *gen_expr(Node *node);
+static void gen_stmt(Node *node);
+
+// アドレス base + idx*scale + disp を分解した形。baseの代わりにvarのアドレスを
+// 基点にすることもある。ロード/ストアではx86のアドレッシングモードにそのまま
+// 埋め込み、値として要るときだけleaで計算する。
+typedef struct
+{
+    Reg *base;
+    Var *var;
+    Reg *idx;
+    int scale;
+    long disp;
+} Addr;
+
+static void set_addr(IR *ir, Addr m)
+{
+    ir->a = m.base;
+    ir->var = m.var;
+    ir->idx = m.idx;
+    ir->scale = m.scale;
+    ir->imm = m.disp;
+}
+
+static Reg *addr_reg(Addr m)
+{
+    if (m.base && !m.idx && !m.disp)
+        return m.base;
+    IR *ir = new_ir(IR_ADDR);
+    ir->dst = new_reg();
+    set_addr(ir, m);
+    return ir->dst;
+}
+
+static Addr gen_mem(Node *node);
+
+// 左辺値nodeのアドレス
+static Addr gen_addr(Node *node)
+{
+    switch (node->kind)
+    {
+    case ND_LVAR:
+        return (Addr){.var = node->var};
+    case ND_DEREF:
+        return gen_mem(node->lhs);
+    default:
+        error("gen_addr: invalid node");
+        return (Addr){0};
+    }
+}
+
+// ポインタの値を持つ式nodeを、アドレスの形で求める
+static Addr gen_mem(Node *node)
+{
+    switch (node->kind)
+    {
+    case ND_ADDR:
+        return gen_addr(node->lhs);
+    case ND_LVAR:
+    case ND_DEREF:
+        // 配列は先頭要素へのポインタとして扱う
+        if (node->ty->kind == TY_ARRAY)
+            return gen_addr(node);
+        break;
+    case ND_ADD:
+    case ND_SUB:
+    {
+        if (!node->ty->base)
+            break;
+        int scale = size_of(node->ty->base);
+        int sign = node->kind == ND_ADD ? 1 : -1;
+
+        // 定数の添字は変位にする
+        if (node->rhs->kind == ND_NUM)
+        {
+            long off = sign * (long)node->rhs->val * scale;
+            if (off == (int)off)
+            {
+                Addr m = gen_mem(node->lhs);
+                if (m.disp + off == (int)(m.disp + off))
+                {
+                    m.disp += off;
+                    return m;
+                }
+                return (Addr){.base = addr_reg(m), .disp = off};
+            }
+        }
+
+        Addr m = gen_mem(node->lhs);
+        Reg *idx = gen_expr(node->rhs);
+
+        // 添字をスケールしてアドレスの足し算に埋め込む。
+        // スケールが1, 2, 4, 8以外ならシフトや乗算で先に掛けておく
+        bool sib = scale == 1 || scale == 2 || scale == 4 || scale == 8;
+        if (!sib)
+        {
+            idx = binop_imm(IR_MUL, idx, scale);
+            scale = 1;
+        }
+        if (sign < 0)
+        {
+            if (scale != 1)
+                idx = binop_imm(IR_MUL, idx, scale);
+            return (Addr){.base = binop(IR_SUB, addr_reg(m), idx)};
+        }
+        if (m.idx)
+            m = (Addr){.base = addr_reg(m)};
+        m.idx = idx;
+        m.scale = scale;
+        return m;
+    }
+    default:
+        break;
+    }
+    return (Addr){.base = gen_expr(node)};
+}
+
+// アドレスmの値を読む
+static Reg *load(Node *node, Addr m)
+{
+    IR *ir = new_ir(IR_LOAD);
+    ir->dst = new_reg();
+    set_addr(ir, m);
+    ir->size = size_of(node->ty);
+    return ir->dst;
+}
+
+static int count_args(Node *node)
+{
+    int nargs = 0;
+    for (Node *arg = node->args; arg; arg = arg->next)
+        nargs++;
+    return nargs;
+}
+
+static IR *gen_call(IRKind kind, Node *node)
+{
+    int nargs = count_args(node);
+    Reg **args = arena_alloc(&ir_arena, sizeof(Reg *) * nargs);
+    int i = 0;
+    for (Node *arg = node->args; arg; arg = arg->next)
+        args[i++] = gen_expr(arg);
+
+    IR *ir = new_ir(kind);
+    ir->size = size_of(node->ty);
+    ir->funcname = node->funcname;
+    ir->args = args;
+    ir->nargs = nargs;
+    return ir;
+}
+
+static Reg *gen_funcall(Node *node)
+{
+    IR *ir = gen_call(IR_CALL, node);
+    ir->dst = new_reg();
+    return ir->dst;
+}
+
+// return f(...) を末尾呼び出しにできるならtrue。
+// 引数がすべてレジスタで渡せて、フレームを畳んでもよい(ローカル変数の
+// アドレスが外に出ていない)ことが条件。戻り値の型がfより狭い場合は
+// 呼び出し元が切り詰めるのでよいが、広い場合はfの戻り値を符号拡張する
+// 必要があるので対象外。
+static bool is_tail_call(Node *node)
+{
+    if (node->kind != ND_FUNCALL || count_args(node) > 6 ||
+        size_of(fn->ty) > size_of(node->ty))
+        return false;
+    for (VarList *vl = fn->locals; vl; vl = vl->next)
+        if (vl->var->addr_taken || vl->var->ty->kind == TY_ARRAY)
+            return false;
+    return true;
+}
+
+// インライン展開した本体を生成し、戻り値の変数を読むところから続ける
+static void gen_inline(Node *node, bool tail)
+{
+    Inline ctx = {inl, new_bb(), tail};
+    inl = &ctx;
+    gen_stmt(node->lhs);
+    inl = ctx.prev;
+    jmp(ctx.end);
+    start_bb(ctx.end);
+}
+
+static Reg *gen_expr(Node *node)
+{
+    switch (node->kind)
+    {
+    case ND_NUM:
+        return imm(node->val);
+    case ND_LVAR:
+        if (node->var->reg)
+            return node->var->reg;
+        // fallthrough
+    case ND_DEREF:
+        if (node->ty->kind == TY_ARRAY)
+            return addr_reg(gen_mem(node));
+        return load(node, gen_addr(node));
+    case ND_ADDR:
+        return addr_reg(gen_mem(node));
+    case ND_ASSIGN:
+    {
+        if (node->lhs->ty->kind == TY_ARRAY)
+            error("not an lvalue");
+        if (node->lhs->kind == ND_LVAR && node->lhs->var->reg)
+        {
+            Reg *val = gen_expr(node->rhs);
+            IR *ir = new_ir(IR_MOV);
+            ir->dst = node->lhs->var->reg;
+            ir->a = val;
+            // longやポインタをintに代入するときだけ切り詰める。int同士の演算の
+            // 結果は(オーバーフローしなければ)常にintの範囲に収まっている
+            ir->size = size_of(node->lhs->ty) < size_of(node->rhs->ty) ? size_of(node->lhs->ty) : 8;
+            return ir->dst;
+        }
+        Addr m = gen_addr(node->lhs);
+        Reg *val = gen_expr(node->rhs);
+        IR *ir = new_ir(IR_STORE);
+        set_addr(ir, m);
+        ir->b = val;
+        ir->size = size_of(node->ty);
+        return val;
+    }
+    case ND_FUNCALL:
+        return gen_funcall(node);
+    case ND_INLINE:
+        gen_inline(node, false);
+        return gen_expr(node->rhs);
+    default:
+        break;
+    }
+
+    // ポインタの加減算はアドレスの計算として扱う
+    if ((node->kind == ND_ADD || node->kind == ND_SUB) && node->ty->base)
+        return addr_reg(gen_mem(node));
+
+    IRKind kind;
+    switch (node->kind)
+    {
+    case ND_ADD:
+        kind = IR_ADD;
+        break;
+    case ND_SUB:
+        kind = IR_SUB;
+        break;
+    case ND_MUL:
+        kind = IR_MUL;
+        break;
+    case ND_DIV:
+        kind = IR_DIV;
+        break;
+    case ND_EQ:
+        kind = IR_EQ;
+        break;
+    case ND_NE:
+        kind = IR_NE;
+        break;
+    case ND_LT:
+        kind = IR_LT;
+        break;
+    case ND_LE:
+        kind = IR_LE;
+        break;
+    default:
+        error("gen_expr: invalid node");
+        return NULL;
+    }
+
+    Reg *a = gen_expr(node->lhs);
+    if (node->rhs->kind == ND_NUM)
+        return binop_imm(kind, a, node->rhs->val);
+    return binop(kind, a, gen_expr(node->rhs));
+}
+
+static IRKind cmp_kind(Node *node)
+{
+    switch (node->kind)
+    {
+    case ND_EQ:
+        return IR_EQ;
+    case ND_NE:
+        return IR_NE;
+    case ND_LT:
+        return IR_LT;
+    case ND_LE:
+        return IR_LE;
+    default:
+        return IR_BR; // 比較ではない
+    }
+}
+
+// 条件が成り立てばthenへ、成り立たなければelsへ分岐する。
+// 比較は0/1の値にせず、比較の結果で直接分岐する。
+static void gen_cond(Node *node, BB *then, BB *els)
+{
+    // 定数なら分岐しない
+    if (node->kind == ND_NUM)
+    {
+        jmp(node->val ? then : els);
+        return;
+    }
+
+    // x == 0 は x の否定、x != 0 は x そのもの
+    if ((node->kind == ND_EQ || node->kind == ND_NE) &&
+        node->rhs->kind == ND_NUM && node->rhs->val == 0)
+    {
+        if (node->kind == ND_EQ)
+            gen_cond(node->lhs, els, then);
+        else
+            gen_cond(node->lhs, then, els);
+        return;
+    }
+
+    IRKind cond = cmp_kind(node);
+    if (cond == IR_BR)
+    {
+        br(gen_expr(node), then, els);
+        return;
+    }
+
+    Reg *a = gen_expr(node->lhs);
+    IR *ir;
+    if (node->rhs->kind == ND_NUM)
+    {
+        ir = new_ir(IR_BR_CMP);
+        ir->imm = node->rhs->val;
+    }
+    else
+    {
+        Reg *b = gen_expr(node->rhs);
+        ir = new_ir(IR_BR_CMP);
+        ir->b = b;
+    }
+    ir->a = a;
+    ir->cond = cond;
+    ir->bb1 = then;
+    ir->bb2 = els;
+}
+
+// 関数からのreturn node
+static void gen_return(Node *node)
+{
+    if (is_tail_call(node))
+    {
+        gen_call(IR_TAILCALL, node);
+    }
+    else
+    {
+        if (node->kind == ND_INLINE)
+        {
+            gen_inline(node, true);
+            node = node->rhs;
+        }
+        Reg *val = gen_expr(node);
+        IR *ir = new_ir(IR_RETURN);
+        ir->a = val;
+    }
+    // 続く文は到達しないが、命令の置き場所として新しいブロックを始める
+    start_bb(new_bb());
+}
+
+static void gen_stmt(Node *node)
+{
+    if (node->line_no)
+        line_no = node->line_no;
+
+    switch (node->kind)
+    {
+    case ND_NULL:
+        return;
+    case ND_EXPR_STMT:
+        gen_expr(node->lhs);
+        return;
+    case ND_RETURN:
+    {
+        if (!inl)
+        {
+            gen_return(node->lhs);
+            return;
+        }
+
+        // インライン展開した本体のreturnは、戻り値の変数への代入になっている。
+        // 代入で切り詰めないなら、代入せずに値を関数から返してよい
+        Node *assign = node->lhs;
+        if (inl->tail && size_of(assign->lhs->ty) >= size_of(assign->rhs->ty))
+        {
+            gen_return(assign->rhs);
+            return;
+        }
+        gen_expr(assign);
+        jmp(inl->end);
+        start_bb(new_bb());
+        return;
+    }
+    case ND_BLOCK:
+        for (Node *n = node->body; n; n = n->next)
+            gen_stmt(n);
+        return;
+    case ND_IF:
+    {
+        BB *then = new_bb();
+        BB *els = node->els ? new_bb() : NULL;
+        BB *end = new_bb();
+
+        gen_cond(node->cond, then, els ? els : end);
+        start_bb(then);
+        gen_stmt(node->then);
+        jmp(end);
+        if (els)
+        {
+            start_bb(els);
+            gen_stmt(node->els);
+            jmp(end);
+        }
+        start_bb(end);
+        return;
+    }
+    case ND_FOR:
+    {
+        BB *body = new_bb();
+        BB *end = new_bb();
+
+        // 条件はループの入口と本体の末尾の両方で評価する。
+        // 繰り返しのたびに通るのは末尾の条件分岐だけになる
+        if (node->init)
+            gen_stmt(node->init);
+        if (node->cond)
+            gen_cond(node->cond, body, end);
+        start_bb(body);
+        gen_stmt(node->then);
+        if (node->inc)
+            gen_stmt(node->inc);
+        if (node->cond)
+            gen_cond(node->cond, body, end);
+        else
+            jmp(body);
+        start_bb(end);
+        return;
+    }
+    default:
+        gen_expr(node);
+        return;
+    }
+}
+
+//
+// 変数のレジスタへの昇格
+//
+// アドレスを取られないスカラーの変数は、メモリに置かずに関数全体で
+// 1つのcallee-savedレジスタを占有させる。ループの中でよく使われる
+// 変数から順に選ぶ。
+//
+
+static int loop_depth;
+
+static void count_uses(Node *node);
+
+static void count_uses_list(Node *node)
+{
+    for (; node; node = node->next)
+        count_uses(node);
+}
+
+static void count_uses(Node *node)
+{
+    if (!node)
+        return;
+
+    switch (node->kind)
+    {
+    case ND_NUM:
+    case ND_NULL:
+        return;
+    case ND_LVAR:
+    {
+        // ループが1段深くなるごとに8倍に数える
+        int weight = 1;
+        for (int i = 0; i < loop_depth && i < 5; i++)
+            weight *= 8;
+        node->var->uses += weight;
+        return;
+    }
+    case ND_ADDR:
+        if (node->lhs->kind == ND_LVAR)
+            node->lhs->var->addr_taken = true;
+        count_uses(node->lhs);
+        return;
+    case ND_BLOCK:
+        count_uses_list(node->body);
+        return;
+    case ND_FUNCALL:
+        count_uses_list(node->args);
+        return;
+    case ND_IF:
+        count_uses(node->cond);
+        count_uses(node->then);
+        count_uses(node->els);
+        return;
+    case ND_FOR:
+        count_uses(node->init);
+        loop_depth++;
+        count_uses(node->cond);
+        count_uses(node->inc);
+        count_uses(node->then);
+        loop_depth--;
+        return;
+    default:
+        count_uses(node->lhs);
+        count_uses(node->rhs);
+        return;
+    }
+}
+
+static bool can_promote(Var *var)
+{
+    return !var->addr_taken && var->uses > 0 && size_of(var->ty) >= 4 &&
+           var->ty->kind != TY_ARRAY;
+}
+
+static void promote_vars()
+{
+    count_uses_list(fn->body);
+
+    // --regallocでは式の途中の値のためにレジスタを2つ残す
+    int limit = opt_regalloc ? NREG - 2 : NREG;
+
+    // 参照の多い順に選ぶ。ローカル変数の数は少ないので単純な選択で足りる
+    for (int n = 0; n < limit; n++)
+    {
+        Var *best = NULL;
+        for (VarList *vl = fn->locals; vl; vl = vl->next)
+            if (!vl->var->reg && can_promote(vl->var) && (!best || vl->var->uses > best->uses))
+                best = vl->var;
+        if (!best)
+            return;
+
+        // 割り当てに使うレジスタと反対側(r15)から使う
+        int rn = NREG - 1 - n;
+        Reg *r = new_reg();
+        r->rn = rn;
+        r->fixed = true;
+        best->reg = r;
+        fn->var_regs |= 1 << rn;
+        fn->used_regs |= 1 << rn;
+    }
+}
+
+void gen_ir(Program *prog)
+{
+    for (fn = prog->fns; fn; fn = fn->next)
+    {
+        fn->bbs = out = new_bb();
+        line_no = 0;
+        promote_vars();
+
+        int i = 0;
+        for (VarList *vl = fn->params; vl; vl = vl->next)
+        {
+            IR *ir = new_ir(IR_STORE_ARG);
+            ir->var = vl->var;
+            ir->imm = i++;
+            ir->size = size_of(vl->var->ty);
+        }
+
+        for (Node *n = fn->body; n; n = n->next)
+            gen_stmt(n);
+    }
+}
+
+//
+// --dump-ir
+//
+
+static char *ir_name[] = {
+    [IR_ADD] = "add",
+    [IR_SUB] = "sub",
+    [IR_MUL] = "mul",
+    [IR_DIV] = "div",
+    [IR_EQ] = "eq",
+    [IR_NE] = "ne",
+    [IR_LT] = "lt",
+    [IR_LE] = "le",
+};
+
+// アドレスを x, r1, r1+r2*8+16 のように表示する
+static void dump_addr(IR *ir)
+{
+    if (ir->a)
+        fprintf(stderr, "r%d", ir->a->vn);
+    else
+        fprintf(stderr, "%s", ir->var->name);
+    if (ir->idx)
+        fprintf(stderr, "+r%d*%d", ir->idx->vn, ir->scale);
+    if (ir->imm)
+        fprintf(stderr, "%+ld", ir->imm);
+}
+
+static void dump_one(IR *ir)
+{
+    switch (ir->kind)
+    {
+    case IR_IMM:
+        fprintf(stderr, "  r%d = %ld\n", ir->dst->vn, ir->imm);
+        return;
+    case IR_ADDR:
+        fprintf(stderr, "  r%d = &", ir->dst->vn);
+        dump_addr(ir);
+        fprintf(stderr, "\n");
+        return;
+    case IR_LOAD:
+        fprintf(stderr, "  r%d = load%d ", ir->dst->vn, ir->size);
+        dump_addr(ir);
+        fprintf(stderr, "\n");
+        return;
+    case IR_STORE:
+        fprintf(stderr, "  store%d ", ir->size);
+        dump_addr(ir);
+        fprintf(stderr, ", r%d\n", ir->b->vn);
+        return;
+    case IR_STORE_ARG:
+        fprintf(stderr, "  %s = arg%ld\n", ir->var->name, ir->imm);
+        return;
+    case IR_MOV:
+        fprintf(stderr, "  r%d = r%d\n", ir->dst->vn, ir->a->vn);
+        return;
+    case IR_CALL:
+    case IR_TAILCALL:
+        if (ir->kind == IR_CALL)
+            fprintf(stderr, "  r%d = call %s(", ir->dst->vn, ir->funcname);
+        else
+            fprintf(stderr, "  tailcall %s(", ir->funcname);
+        for (int i = 0; i < ir->nargs; i++)
+            fprintf(stderr, "%sr%d", i ? ", " : "", ir->args[i]->vn);
+        fprintf(stderr, ")\n");
+        return;
+    case IR_JMP:
+        fprintf(stderr, "  jmp .L%d\n", ir->bb1->label);
+        return;
+    case IR_BR:
+        fprintf(stderr, "  br r%d, .L%d, .L%d\n", ir->a->vn, ir->bb1->label, ir->bb2->label);
+        return;
+    case IR_BR_CMP:
+        if (ir->b)
+            fprintf(stderr, "  br %s r%d, r%d, .L%d, .L%d\n", ir_name[ir->cond],
+                    ir->a->vn, ir->b->vn, ir->bb1->label, ir->bb2->label);
+        else
+            fprintf(stderr, "  br %s r%d, %ld, .L%d, .L%d\n", ir_name[ir->cond],
+                    ir->a->vn, ir->imm, ir->bb1->label, ir->bb2->label);
+        return;
+    case IR_RETURN:
+        fprintf(stderr, "  ret r%d\n", ir->a->vn);
+        return;
+    default:
+        if (ir->b)
+            fprintf(stderr, "  r%d = %s r%d, r%d\n",
+                    ir->dst->vn, ir_name[ir->kind], ir->a->vn, ir->b->vn);
+        else
+            fprintf(stderr, "  r%d = %s r%d, %ld\n",
+                    ir->dst->vn, ir_name[ir->kind], ir->a->vn, ir->imm);
+        return;
+    }
+}
+
+void dump_ir(Program *prog)
+{
+    for (Function *fn = prog->fns; fn; fn = fn->next)
+    {
+        fprintf(stderr, "%s():\n", fn->name);
+        for (BB *bb = fn->bbs; bb; bb = bb->next)
+        {
+            fprintf(stderr, ".L%d:\n", bb->label);
+            for (IR *ir = bb->ir; ir; ir = ir->next)
+                dump_one(ir);
+        }
+    }
+}
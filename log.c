@@ -1,5 +1,6 @@
 #include <stdarg.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include "9cc.h"
 
 void error(char *fmt, ...)
@@ -11,57 +12,83 @@ void error(char *fmt, ...)
     exit(1);
 }
 
+// エラー箇所をファイル名、行番号、列番号と、その行の内容で報告する
+//
+// foo.c:2:9: int x = y;
+//                    ^ 変数が見つかりません
 void error_at(char *loc, char *fmt, ...)
 {
     va_list ap;
     va_start(ap, fmt);
 
-    int pos = loc - user_input;
-    fprintf(stderr, "%s\n", user_input);
-    fprintf(stderr, "%*s", pos, ""); // print pos spaces.
+    // locを含む行の先頭と末尾を探す
+    char *line = loc;
+    while (user_input < line && line[-1] != '\n')
+        line--;
+    char *end = loc;
+    while (*end && *end != '\n')
+        end++;
+
+    int line_no = 1;
+    for (char *p = user_input; p < line; p++)
+        if (*p == '\n')
+            line_no++;
+
+    int col = loc - line;
+    int indent = fprintf(stderr, "%s:%d:%d: ", filename, line_no, col + 1);
+    fprintf(stderr, "%.*s\n", (int)(end - line), line);
+    fprintf(stderr, "%*s", indent + col, ""); // print pos spaces.
     fprintf(stderr, "^ ");
     vfprintf(stderr, fmt, ap);
     fprintf(stderr, "\n");
     exit(1);
 }
 
+#ifdef ENABLE_LOG
+
+// NINECC_LOGが設定されていなければNULLのままで、ログは出力しない
+static FILE *log_file;
+
 void init_log()
 {
-    FILE *file = fopen("log.txt", "w");
-    if (file == NULL)
+    char *path = getenv("NINECC_LOG");
+    if (!path || !*path)
+        return;
+
+    log_file = fopen(path, "w");
+    if (log_file == NULL)
     {
-        fprintf(stderr, "log.txtを開くことができませんでした\n");
+        fprintf(stderr, "%sを開くことができませんでした\n", path);
         return;
     }
-    fclose(file);
+    // 書き出しはexit時のフラッシュにまとめる
+    setvbuf(log_file, NULL, _IOFBF, 1 << 20);
 }
 
-void log(const char *fmt, ...)
+void log_printf(const char *fmt, ...)
 {
-    FILE *file = fopen("log.txt", "a");
-    if (file == NULL)
-    {
-        fprintf(stderr, "log.txtを開くことができませんでした\n");
+    if (!log_file)
         return;
-    }
 
     va_list ap;
     va_start(ap, fmt);
-    vfprintf(file, fmt, ap);
+    vfprintf(log_file, fmt, ap);
     va_end(ap);
 
-    fprintf(file, "\n");
-    fclose(file);
+    fputc('\n', log_file);
 }
 
-void log_tokens(Token *token)
+// 入力の終わりまでトークンを読んで表示し、先頭に戻す
+void log_tokens()
 {
     log("Tokens:");
-    while (token)
+    for (;; next_token())
     {
         log("  Token kind: %d, str: %.*s, len: %d", token->kind, token->len, token->str, token->len);
-        token = token->next;
+        if (at_eof())
+            break;
     }
+    tokenize();
 }
 
 void log_node(Node *node)
@@ -85,7 +112,7 @@ void log_node(Node *node)
         break;
     case ND_NUM:
         log("  Node kind: ND_NUM, val: %d", node->val);
-        break;
+        return;
     case ND_EQ:
         log("  Node kind: ND_EQ");
         break;
@@ -107,10 +134,11 @@ void log_node(Node *node)
         break;
     case ND_LVAR:
         log("  Node kind: ND_LVAR, varname: %s, type: %d", node->var->name, node->var->ty->kind);
-        break;
+        return;
     case ND_BLOCK:
-        log("  Node kind: ND_BLOCK, body: %p", node->body);
-        break;
+        log("  Node kind: ND_BLOCK");
+        log_nodes(node->body);
+        return;
     case ND_RETURN:
         log("  Node kind: ND_RETURN");
         log("  Expression:");
@@ -124,7 +152,7 @@ void log_node(Node *node)
         log_node(node->then);
         log("  Else:");
         log_node(node->els);
-        break;
+        return;
     case ND_FOR:
         log("  Node kind: ND_FOR");
         log("  Init:");
@@ -136,22 +164,20 @@ void log_node(Node *node)
         log("  Increment:");
         if (node->inc)
             log_node(node->inc);
-        break;
+        return;
     case ND_FUNCALL:
         log("  Node kind: ND_FUNCALL, funcname: %s", node->funcname);
-        break;
+        return;
     case ND_NULL:
         log("  Node kind: ND_NULL");
-        break;
+        return;
     case ND_EXPR_STMT:
         log("  Node kind: ND_EXPR_STMT");
         log("  Expression:");
         log_node(node->lhs);
         break;
-    case ND_SIZEOF:
-        log("  Node kind: ND_SIZEOF");
-        log("  Expression:");
-        log_node(node->lhs);
+    case ND_INLINE:
+        log("  Node kind: ND_INLINE");
         break;
     case ND_ADDR:
         log("  Node kind: ND_ADDR");
@@ -168,6 +194,7 @@ void log_node(Node *node)
         break;
     }
 
+    // ここから先は共用体のlhs/rhsを使うノードだけ
     if (node->lhs)
     {
         log("  Left-hand side:");
@@ -181,12 +208,12 @@ void log_node(Node *node)
     }
 }
 
-void log_nodes(Node *nodes[])
+void log_nodes(Node *nodes)
 {
     log("Nodes:");
-    for (int i = 0; nodes[i] != NULL; i++)
+    for (Node *node = nodes; node; node = node->next)
     {
-        log_node(nodes[i]);
+        log_node(node);
     }
 }
 
@@ -205,4 +232,6 @@ void log_function(Function *fn)
     {
         log("    %s", vl->var->name);
     }
-}
\ No newline at end of file
+}
+
+#endif // ENABLE_LOG
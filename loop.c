@@ -0,0 +1,675 @@
+#include <limits.h>
+#include <stdlib.h>
+#include "9cc.h"
+
+// ループの最適化。
+// インライン展開の後に呼ばれ、ND_FOR(forとwhile)ごとに内側から順に次のことを行う。
+// - 帰納変数(ループの中で i = i + c の形でだけ更新される変数)を見つける。
+//   whileで本体の末尾にある更新は、forのincに移して同じ形にそろえる。
+// - 初期値、条件、増分がすべて定数で回数が少ないループは、帰納変数を
+//   定数に置き換えた本体をその回数だけ並べたブロックに展開する。
+// - 展開しないループでは、ループの中で値の変わらない式(ループ不変式)を
+//   ループの前で新しいローカル変数に計算しておく。
+//
+// 値が変わらないとみなすのは、ループの中で代入されず、アドレスも
+// 取られないローカル変数と、配列のアドレスだけ。メモリの読み出しは
+// ポインタ経由の書き込みや関数呼び出しで変わりうるので対象にしない。
+
+#define UNROLL_MAX 8     // 展開する最大の回数
+#define UNROLL_NODES 128 // 展開した本体のノード数の合計の上限
+
+static Function *fn;
+
+static Node *make_node(NodeKind kind, Node *lhs, Node *rhs, Type *ty, int line_no)
+{
+    Node *node = arena_alloc(&node_arena, sizeof(Node));
+    node->kind = kind;
+    node->lhs = lhs;
+    node->rhs = rhs;
+    node->ty = ty;
+    node->line_no = line_no;
+    return node;
+}
+
+static Node *new_lvar(Var *var, int line_no)
+{
+    Node *node = make_node(ND_LVAR, NULL, NULL, var->ty, line_no);
+    node->var = var;
+    return node;
+}
+
+static Node *new_num(long val, Type *ty, int line_no)
+{
+    Node *node = make_node(ND_NUM, NULL, NULL, ty, line_no);
+    node->val = val;
+    return node;
+}
+
+static Node *new_stmt(Node *expr)
+{
+    return make_node(ND_EXPR_STMT, expr, NULL, NULL, expr->line_no);
+}
+
+// 関数fnに新しいローカル変数を作る
+static Var *new_local(char *name, Type *ty)
+{
+    Var *var = arena_alloc(&node_arena, sizeof(Var));
+    var->name = name;
+    var->ty = ty;
+    var->is_local = true;
+
+    VarList *vl = arena_alloc(&node_arena, sizeof(VarList));
+    vl->var = var;
+    vl->next = fn->locals;
+    fn->locals = vl;
+    return var;
+}
+
+//
+// 変数の代入とアドレスの調査
+//
+
+static bool has_loop; // scan()したなかにループがあった
+
+// アドレスを取られる変数に印を付け、ノード数を返す
+static int scan(Node *node);
+
+static int scan_list(Node *node)
+{
+    int n = 0;
+    for (; node; node = node->next)
+        n += scan(node);
+    return n;
+}
+
+static int scan(Node *node)
+{
+    if (!node)
+        return 0;
+
+    switch (node->kind)
+    {
+    case ND_NUM:
+    case ND_LVAR:
+    case ND_NULL:
+        return 1;
+    case ND_ADDR:
+        if (node->lhs->kind == ND_LVAR)
+            node->lhs->var->addr_taken = true;
+        return 1 + scan(node->lhs);
+    case ND_BLOCK:
+        return 1 + scan_list(node->body);
+    case ND_FUNCALL:
+        return 1 + scan_list(node->args);
+    case ND_FOR:
+        has_loop = true;
+        // fallthrough
+    case ND_IF:
+        return 1 + scan(node->cond) + scan(node->then) + scan(node->els) + scan(node->init) +
+               scan(node->inc);
+    default:
+        return 1 + scan(node->lhs) + scan(node->rhs);
+    }
+}
+
+// ループの中で代入される変数
+static Var **assigned;
+static int nassigned;
+static int assigned_cap;
+
+static void add_assigned(Var *var)
+{
+    for (int i = 0; i < nassigned; i++)
+        if (assigned[i] == var)
+            return;
+    if (nassigned == assigned_cap)
+    {
+        // --streamでは関数ごとにnode_arenaを解放するので、関数をまたいで使う領域はmallocで持つ
+        assigned_cap = assigned_cap ? assigned_cap * 2 : 16;
+        assigned = realloc(assigned, sizeof(Var *) * assigned_cap);
+    }
+    assigned[nassigned++] = var;
+}
+
+static bool is_assigned(Var *var)
+{
+    for (int i = 0; i < nassigned; i++)
+        if (assigned[i] == var)
+            return true;
+    return false;
+}
+
+static void collect_assigned(Node *node);
+
+static void collect_assigned_list(Node *node)
+{
+    for (; node; node = node->next)
+        collect_assigned(node);
+}
+
+static void collect_assigned(Node *node)
+{
+    if (!node)
+        return;
+
+    switch (node->kind)
+    {
+    case ND_NUM:
+    case ND_LVAR:
+    case ND_NULL:
+        return;
+    case ND_ASSIGN:
+        if (node->lhs->kind == ND_LVAR)
+            add_assigned(node->lhs->var);
+        collect_assigned(node->lhs);
+        collect_assigned(node->rhs);
+        return;
+    case ND_BLOCK:
+        collect_assigned_list(node->body);
+        return;
+    case ND_FUNCALL:
+        collect_assigned_list(node->args);
+        return;
+    case ND_IF:
+    case ND_FOR:
+        collect_assigned(node->cond);
+        collect_assigned(node->then);
+        collect_assigned(node->els);
+        collect_assigned(node->init);
+        collect_assigned(node->inc);
+        return;
+    default:
+        collect_assigned(node->lhs);
+        collect_assigned(node->rhs);
+        return;
+    }
+}
+
+//
+// 帰納変数
+//
+
+// nodeが var = var + c または var = var - c なら、varとcを返す
+static bool is_step(Node *node, Var **var, long *step)
+{
+    if (!node || node->kind != ND_ASSIGN || node->lhs->kind != ND_LVAR)
+        return false;
+    Var *v = node->lhs->var;
+    if (!v->is_local || v->addr_taken || v->ty->base || v->ty->kind == TY_ARRAY)
+        return false;
+
+    Node *rhs = node->rhs;
+    if (rhs->kind != ND_ADD && rhs->kind != ND_SUB)
+        return false;
+    Node *l = rhs->lhs, *r = rhs->rhs;
+    if (rhs->kind == ND_ADD && l->kind == ND_NUM)
+    {
+        Node *t = l;
+        l = r;
+        r = t;
+    }
+    if (l->kind != ND_LVAR || l->var != v || r->kind != ND_NUM)
+        return false;
+
+    *var = v;
+    *step = rhs->kind == ND_ADD ? r->val : -r->val;
+    return true;
+}
+
+// whileの本体の最後の文が帰納変数の更新なら、incに移す
+static void move_step_to_inc(Node *node)
+{
+    if (node->inc || node->then->kind != ND_BLOCK)
+        return;
+
+    Node *prev = NULL;
+    Node *last = node->then->body;
+    if (!last)
+        return;
+    for (; last->next; last = last->next)
+        prev = last;
+
+    Var *var;
+    long step;
+    if (last->kind != ND_EXPR_STMT || !is_step(last->lhs, &var, &step))
+        return;
+
+    if (prev)
+        prev->next = NULL;
+    else
+        node->then->body = NULL;
+    node->inc = last->lhs;
+}
+
+// nodeが var = 定数 なら、その値を返す
+static bool is_init(Node *node, Var *var, long *val)
+{
+    if (!node || node->kind != ND_ASSIGN || node->lhs->kind != ND_LVAR ||
+        node->lhs->var != var || node->rhs->kind != ND_NUM)
+        return false;
+    *val = node->rhs->val;
+    return true;
+}
+
+// 条件nodeを var = v として評価する
+static bool eval_cond(Node *node, Var *var, long v, bool *result)
+{
+    if (node->kind != ND_LT && node->kind != ND_LE && node->kind != ND_NE)
+        return false;
+
+    long val[2];
+    Node *operand[2] = {node->lhs, node->rhs};
+    for (int i = 0; i < 2; i++)
+    {
+        if (operand[i]->kind == ND_NUM)
+            val[i] = operand[i]->val;
+        else if (operand[i]->kind == ND_LVAR && operand[i]->var == var)
+            val[i] = v;
+        else
+            return false;
+    }
+
+    if (node->kind == ND_LT)
+        *result = val[0] < val[1];
+    else if (node->kind == ND_LE)
+        *result = val[0] <= val[1];
+    else
+        *result = val[0] != val[1];
+    return true;
+}
+
+//
+// 展開
+//
+
+// 値valを型tyの変数に代入したときに、変数が持つ値
+static long stored_value(long val, Type *ty)
+{
+    switch (size_of(ty))
+    {
+    case 1:
+        return (signed char)val;
+    case 4:
+        return (int)val;
+    default:
+        return val;
+    }
+}
+
+// 本体を複製し、varの参照を値valに置き換える
+static Node *copy(Node *node, Var *var, long val);
+
+static Node *copy_list(Node *node, Var *var, long val)
+{
+    Node head = {};
+    Node *cur = &head;
+    for (; node; node = node->next)
+        cur = cur->next = copy(node, var, val);
+    return head.next;
+}
+
+static Node *copy(Node *node, Var *var, long val)
+{
+    if (!node)
+        return NULL;
+
+    if (node->kind == ND_LVAR && node->var == var)
+        return new_num(val, node->ty, node->line_no);
+
+    Node *n = arena_alloc(&node_arena, sizeof(Node));
+    *n = *node;
+    n->next = NULL;
+
+    switch (node->kind)
+    {
+    case ND_NUM:
+    case ND_LVAR:
+    case ND_NULL:
+        break;
+    case ND_BLOCK:
+        n->body = copy_list(node->body, var, val);
+        break;
+    case ND_FUNCALL:
+        n->args = copy_list(node->args, var, val);
+        break;
+    case ND_IF:
+    case ND_FOR:
+        n->cond = copy(node->cond, var, val);
+        n->then = copy(node->then, var, val);
+        n->els = copy(node->els, var, val);
+        n->init = copy(node->init, var, val);
+        n->inc = copy(node->inc, var, val);
+        break;
+    default:
+        n->lhs = copy(node->lhs, var, val);
+        n->rhs = copy(node->rhs, var, val);
+        break;
+    }
+    return n;
+}
+
+// 回数が定数で少ないループを展開したブロックに書き換える。
+// initがなければ、直前の文prevを初期値の代入とみなす
+static bool unroll(Node *node, Node *prev)
+{
+    Var *var;
+    long step;
+    if (!node->cond || !is_step(node->inc, &var, &step))
+        return false;
+
+    long start;
+    if (!is_init(node->init, var, &start) &&
+        !(!node->init && prev && prev->kind == ND_EXPR_STMT && is_init(prev->lhs, var, &start)))
+        return false;
+
+    // 本体で帰納変数を書き換えるループや、内側にループがあるものは展開しない
+    nassigned = 0;
+    collect_assigned(node->then);
+    if (is_assigned(var))
+        return false;
+    has_loop = false;
+    int size = scan(node->then);
+    if (has_loop)
+        return false;
+
+    // 回数を数える。var + stepはintの範囲に収まっていなければならず、
+    // その結果を帰納変数の型に切り詰めたものが次の値になる
+    long vals[UNROLL_MAX];
+    int n = 0;
+    long v = stored_value(start, var->ty);
+    for (;;)
+    {
+        bool taken;
+        if (!eval_cond(node->cond, var, v, &taken))
+            return false;
+        if (!taken)
+            break;
+        if (n == UNROLL_MAX || (n + 1) * size > UNROLL_NODES)
+            return false;
+        vals[n++] = v;
+        v += step;
+        if (v < INT_MIN || INT_MAX < v)
+            return false;
+        v = stored_value(v, var->ty);
+    }
+
+    Node head = {};
+    Node *cur = &head;
+    if (node->init)
+        cur = cur->next = new_stmt(node->init);
+    for (int i = 0; i < n; i++)
+    {
+        Node *body = copy(node->then, var, vals[i]);
+        fold_stmt(body);
+        cur = cur->next = body;
+    }
+    // ループを抜けた後の帰納変数の値
+    Node *lhs = new_lvar(var, node->line_no);
+    cur->next = new_stmt(make_node(ND_ASSIGN, lhs, new_num(v, var->ty, node->line_no), var->ty,
+                                   node->line_no));
+
+    Node *next = node->next;
+    int line_no = node->line_no;
+    *node = (Node){.kind = ND_BLOCK, .line_no = line_no, .next = next};
+    node->body = head.next;
+    return true;
+}
+
+//
+// ループ不変式の移動
+//
+
+// ループの前で計算する式と、その値を置く変数
+static Node *hoisted;   // 代入文の並び
+static Node *hoist_cur; // hoistedの末尾
+
+static bool invariant(Node *node)
+{
+    switch (node->kind)
+    {
+    case ND_NUM:
+        return true;
+    case ND_LVAR:
+    {
+        if (node->ty->kind == TY_ARRAY)
+            return true;
+        Var *var = node->var;
+        return var->is_local && !var->addr_taken && !is_assigned(var);
+    }
+    case ND_ADD:
+    case ND_SUB:
+    case ND_MUL:
+        return invariant(node->lhs) && invariant(node->rhs);
+    default:
+        return false;
+    }
+}
+
+static bool same(Node *a, Node *b)
+{
+    if (a->kind != b->kind)
+        return false;
+    switch (a->kind)
+    {
+    case ND_NUM:
+        return a->val == b->val;
+    case ND_LVAR:
+        return a->var == b->var;
+    default:
+        return same(a->lhs, b->lhs) && same(a->rhs, b->rhs);
+    }
+}
+
+// nodeをループの前で計算した変数の参照に置き換える
+static void hoist_expr(Node *node)
+{
+    // 同じ式をすでに計算していればその変数を使う
+    Var *var = NULL;
+    for (Node *n = hoisted; n; n = n->next)
+    {
+        if (same(n->lhs->rhs, node))
+        {
+            var = n->lhs->lhs->var;
+            break;
+        }
+    }
+
+    if (!var)
+    {
+        // 配列は先頭要素へのポインタにする
+        Type *ty = node->ty->kind == TY_ARRAY ? pointer_to(node->ty->base) : node->ty;
+        var = new_local(node->kind == ND_LVAR ? node->var->name : "", ty);
+
+        Node *expr = arena_alloc(&node_arena, sizeof(Node));
+        *expr = *node;
+        expr->next = NULL;
+        Node *assign = make_node(ND_ASSIGN, new_lvar(var, node->line_no), expr, ty, node->line_no);
+        Node *stmt = new_stmt(assign);
+        if (hoist_cur)
+            hoist_cur = hoist_cur->next = stmt;
+        else
+            hoisted = hoist_cur = stmt;
+    }
+
+    Node *next = node->next;
+    *node = *new_lvar(var, node->line_no);
+    node->next = next;
+}
+
+static void hoist(Node *node);
+
+static void hoist_list(Node *node)
+{
+    for (; node; node = node->next)
+        hoist(node);
+}
+
+// ループの中のnodeから不変式を探して移動する
+static void hoist(Node *node)
+{
+    if (!node)
+        return;
+
+    switch (node->kind)
+    {
+    case ND_NUM:
+    case ND_LVAR:
+    case ND_NULL:
+        return;
+    case ND_ASSIGN:
+        // 代入先の変数はそのまま残す
+        if (node->lhs->kind != ND_LVAR)
+            hoist(node->lhs);
+        hoist(node->rhs);
+        return;
+    case ND_ADDR:
+        if (node->lhs->kind != ND_LVAR)
+            hoist(node->lhs);
+        return;
+    case ND_BLOCK:
+        hoist_list(node->body);
+        return;
+    case ND_FUNCALL:
+        hoist_list(node->args);
+        return;
+    case ND_IF:
+    case ND_FOR:
+        hoist(node->cond);
+        hoist(node->then);
+        hoist(node->els);
+        hoist(node->init);
+        hoist(node->inc);
+        return;
+    case ND_ADD:
+    case ND_SUB:
+        if (node->ty->base)
+        {
+            // ポインタの加減算はアドレッシングモードに埋め込まれるので、
+            // 全体ではなく部分を移す。RIP相対のグローバル変数の配列には
+            // 添字を付けられず毎回leaが要るので、添字が定数でなければ移す
+            Node *lhs = node->lhs;
+            if (lhs->kind == ND_LVAR && lhs->ty->kind == TY_ARRAY && !lhs->var->is_local &&
+                node->rhs->kind != ND_NUM)
+                hoist_expr(lhs);
+            else
+                hoist(lhs);
+            hoist(node->rhs);
+            return;
+        }
+        // fallthrough
+    case ND_MUL:
+        if (invariant(node))
+        {
+            hoist_expr(node);
+            return;
+        }
+        hoist(node->lhs);
+        hoist(node->rhs);
+        return;
+    default:
+        hoist(node->lhs);
+        hoist(node->rhs);
+        return;
+    }
+}
+
+// ループの前に不変式の計算を置く。初期化式はそれより前に評価する
+static void hoist_loop(Node *node)
+{
+    nassigned = 0;
+    collect_assigned(node->cond);
+    collect_assigned(node->then);
+    collect_assigned(node->inc);
+
+    hoisted = hoist_cur = NULL;
+    hoist(node->cond);
+    hoist(node->then);
+    hoist(node->inc);
+    if (!hoisted)
+        return;
+
+    Node *loop = arena_alloc(&node_arena, sizeof(Node));
+    *loop = *node;
+    loop->next = NULL;
+
+    Node head = {};
+    Node *cur = &head;
+    if (loop->init)
+    {
+        cur = cur->next = new_stmt(loop->init);
+        loop->init = NULL;
+    }
+    cur->next = hoisted;
+    hoist_cur->next = loop;
+
+    Node *next = node->next;
+    int line_no = node->line_no;
+    *node = (Node){.kind = ND_BLOCK, .line_no = line_no, .next = next};
+    node->body = head.next;
+}
+
+//
+// ループの走査
+//
+
+static void walk(Node *node, Node *prev);
+
+static void walk_list(Node *node)
+{
+    Node *prev = NULL;
+    for (; node; node = node->next)
+    {
+        walk(node, prev);
+        prev = node;
+    }
+}
+
+static void walk(Node *node, Node *prev)
+{
+    if (!node)
+        return;
+
+    switch (node->kind)
+    {
+    case ND_NUM:
+    case ND_LVAR:
+    case ND_NULL:
+        return;
+    case ND_BLOCK:
+        walk_list(node->body);
+        return;
+    case ND_FUNCALL:
+        walk_list(node->args);
+        return;
+    case ND_IF:
+        walk(node->cond, NULL);
+        walk(node->then, NULL);
+        walk(node->els, NULL);
+        return;
+    case ND_FOR:
+        walk(node->init, NULL);
+        walk(node->cond, NULL);
+        walk(node->inc, NULL);
+        walk(node->then, NULL);
+        move_step_to_inc(node);
+        if (!unroll(node, prev))
+            hoist_loop(node);
+        return;
+    default:
+        walk(node->lhs, NULL);
+        walk(node->rhs, NULL);
+        return;
+    }
+}
+
+void optimize_loops(Program *prog)
+{
+    if (opt_no_loop_opt)
+        return;
+
+    for (fn = prog->fns; fn; fn = fn->next)
+    {
+        scan_list(fn->body);
+        walk_list(fn->body);
+    }
+}
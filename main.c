@@ -1,29 +1,252 @@
+#define _DEFAULT_SOURCE // MAP_ANONYMOUS
+#include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
 #include "9cc.h"
 
+char *filename;
 char *user_input;
 Token *token;
+bool opt_regalloc;
+bool opt_mem_stats;
+bool opt_syntax_only;
+char *opt_output;
+bool opt_time_report;
+bool opt_debug;
+bool opt_no_peephole;
+bool opt_dump_ir;
+bool opt_stream;
+bool opt_no_simd;
+static bool opt_lex_only;
+bool opt_no_loop_opt;
+int opt_inline_limit = 30;
+static bool opt_peephole_stats;
+
+static void usage()
+{
+    fprintf(stderr, "usage: 9cc [-o <path>] [-g] [--regalloc] [--no-peephole] [--peephole-stats] [--dump-ir] [--inline-limit <n>] [--no-loop-opt] [--stream] [--no-simd] [--lex-only] [--mem-stats] [-ftime-report] [-fsyntax-only] <file>\n");
+    exit(1);
+}
+
+// 標準入力を最後まで読み、NUL終端したバッファを返す。
+// 読み終えたときには必ず4096バイト以上の空きがあるので、INPUT_PADDINGの分も足りる
+static char *read_stdin()
+{
+    size_t cap = 4096;
+    size_t len = 0;
+    char *buf = malloc(cap);
+
+    for (;;)
+    {
+        if (cap - len < 4096)
+            buf = realloc(buf, cap *= 2);
+        ssize_t n = read(STDIN_FILENO, buf + len, cap - len - 1);
+        if (n < 0)
+            error("標準入力を読み込めません: %s", strerror(errno));
+        if (n == 0)
+            break;
+        len += n;
+    }
+    buf[len] = '\0';
+    return buf;
+}
+
+// ファイルをコピーせずにmmapで読み込む。
+// トークナイザは入力がNUL終端され、その後にINPUT_PADDINGバイト
+// 読める領域が続くことを前提にしているので、その分だけファイルサイズより
+// 大きい匿名マッピングを先に確保し、
+// その先頭にファイルを重ねてマップする。ファイルの末尾以降は
+// ゼロで埋められているので、入力の直後には必ずNULがある。
+static char *read_file(char *path)
+{
+    if (!strcmp(path, "-"))
+        return read_stdin();
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        error("%s を開けません: %s", path, strerror(errno));
+
+    struct stat st;
+    if (fstat(fd, &st) < 0)
+        error("%s の情報を取得できません: %s", path, strerror(errno));
+
+    size_t size = st.st_size;
+    char *buf = mmap(NULL, size + 1 + INPUT_PADDING, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buf == MAP_FAILED)
+        error("メモリを確保できません: %s", strerror(errno));
+    if (size > 0 &&
+        mmap(buf, size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED)
+        error("%s をマップできません: %s", path, strerror(errno));
+
+    close(fd);
+    return buf;
+}
+
+static double now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+// -ftime-report: 直前の呼び出しからの経過時間をフェーズnameの時間として表示する
+static void phase_done(char *name)
+{
+    static double last;
+    double t = now_ms();
+    if (opt_time_report && name)
+        fprintf(stderr, "%-10s %9.3f ms\n", name, t - last);
+    last = t;
+}
+
+// 関数を1つずつパースからコード生成まで済ませ、次の関数を読む前に
+// その関数の構文木と中間表現を解放する。関数をまたいで残すのは、
+// グローバル変数、関数の戻り値の型、名前の文字列と型だけ。
+// 展開する本体が残らないので、インライン展開はしない。
+static void compile_stream()
+{
+    Program prog = {};
+    if (!opt_syntax_only)
+        codegen_begin();
+
+    for (Function *fn; (fn = next_function(&prog));)
+    {
+        if (!opt_syntax_only)
+        {
+            Program one = {.fns = fn};
+            fold_constants(&one);
+            optimize_loops(&one);
+            gen_ir(&one);
+            if (opt_dump_ir)
+                dump_ir(&one);
+            codegen_text(&one);
+            emit_flush(opt_output);
+        }
+        arena_free(&node_arena);
+        arena_free(&ir_arena);
+    }
+
+    if (!opt_syntax_only)
+    {
+        codegen_data(&prog);
+        emit_flush(opt_output);
+    }
+}
+
+static int finish()
+{
+    emit_close();
+    arena_free(&symbol_arena);
+    arena_free(&node_arena);
+    arena_free(&type_arena);
+    arena_free(&ir_arena);
+    if (opt_mem_stats)
+        print_arena_stats();
+    if (opt_peephole_stats)
+        print_peephole_stats();
+    return 0;
+}
 
 int main(int argc, char **argv)
 {
     init_log();
-    if (argc != 2)
+
+    char *input = NULL;
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "-o"))
+        {
+            if (++i == argc)
+                usage();
+            opt_output = argv[i];
+        }
+        else if (!strcmp(argv[i], "-g"))
+            opt_debug = true;
+        else if (!strcmp(argv[i], "--regalloc"))
+            opt_regalloc = true;
+        else if (!strcmp(argv[i], "--no-peephole"))
+            opt_no_peephole = true;
+        else if (!strcmp(argv[i], "--peephole-stats"))
+            opt_peephole_stats = true;
+        else if (!strcmp(argv[i], "--dump-ir"))
+            opt_dump_ir = true;
+        else if (!strcmp(argv[i], "--inline-limit"))
+        {
+            if (++i == argc)
+                usage();
+            opt_inline_limit = atoi(argv[i]);
+        }
+        else if (!strcmp(argv[i], "--no-loop-opt"))
+            opt_no_loop_opt = true;
+        else if (!strcmp(argv[i], "--stream"))
+            opt_stream = true;
+        else if (!strcmp(argv[i], "--no-simd"))
+            opt_no_simd = true;
+        else if (!strcmp(argv[i], "--lex-only"))
+            opt_lex_only = true;
+        else if (!strcmp(argv[i], "--mem-stats"))
+            opt_mem_stats = true;
+        else if (!strcmp(argv[i], "-ftime-report"))
+            opt_time_report = true;
+        else if (!strcmp(argv[i], "-fsyntax-only"))
+            opt_syntax_only = true;
+        else if (!input)
+            input = argv[i];
+        else
+            usage();
+    }
+    if (!input)
     {
         fprintf(stderr, "引数の個数が正しくありません\n");
-        return 1;
+        usage();
     }
 
     // トークナイズしてパースする
-    user_input = argv[1];
-    token = tokenize();
-    // log_tokens(token);
+    phase_done(NULL);
+    filename = strcmp(input, "-") ? input : "<stdin>";
+    user_input = read_file(input);
+    phase_done("read");
+    tokenize();
+    // log_tokens();
+    if (opt_lex_only)
+    {
+        // トークナイザの速さを測るため、入力の終わりまでトークンを読むだけにする
+        while (!at_eof())
+            next_token();
+        phase_done("lex");
+        return finish();
+    }
+    if (opt_stream)
+    {
+        compile_stream();
+        phase_done("compile");
+        return finish();
+    }
     Program *prog = program();
-    add_type(prog);
-    // for (int i = 0; i < 100; i++)
-    // {
-    //     log_nodes(prog->fns[i].body);
-    // }
+    phase_done("parse");
+    if (opt_syntax_only)
+        return 0;
+    fold_constants(prog);
+    phase_done("fold");
+    inline_functions(prog);
+    phase_done("inline");
+    optimize_loops(prog);
+    phase_done("loop");
+    gen_ir(prog);
+    if (opt_dump_ir)
+        dump_ir(prog);
+    phase_done("ir");
+    // for (Function *fn = prog->fns; fn; fn = fn->next)
+    //     log_nodes(fn->body);
     codegen(prog);
-
-    return 0;
+    phase_done("codegen");
+    emit_flush(opt_output);
+    phase_done("output");
+    return finish();
 }
\ No newline at end of file
@@ -5,14 +5,53 @@
 VarList *locals;
 VarList *globals;
 
+// ブロックスコープ。
+// var_mapは名前から現在見えている変数を引く表で、スコープを抜けるときに
+// そのスコープで宣言した変数を取り除き、隠していた外側の変数に戻す。
+typedef struct VarScope VarScope;
+struct VarScope
+{
+    VarScope *next; // 同じスコープで宣言された変数
+    Var *var;
+    Var *shadowed; // この宣言によって隠された変数
+};
+
+typedef struct Scope Scope;
+struct Scope
+{
+    Scope *parent;
+    VarScope *vars;
+};
+
+static HashMap var_map;
+static Scope global_scope;
+static Scope *scope = &global_scope;
+
+static void enter_scope()
+{
+    Scope *sc = arena_alloc(&node_arena, sizeof(Scope));
+    sc->parent = scope;
+    scope = sc;
+}
+
+static void leave_scope()
+{
+    for (VarScope *vs = scope->vars; vs; vs = vs->next)
+        hashmap_put(&var_map, vs->var->name, vs->shadowed);
+    scope = scope->parent;
+}
+
+// nameはintern()済みの文字列。
+// グローバル変数は関数の構文木を解放した後も使うので、symbol_arenaに置く
 Var *push_var(char *name, Type *ty, bool is_local)
 {
-    Var *var = calloc(1, sizeof(Var));
+    Arena *arena = is_local ? &node_arena : &symbol_arena;
+    Var *var = arena_alloc(arena, sizeof(Var));
     var->name = name;
     var->ty = ty;
     var->is_local = is_local;
 
-    VarList *vl = calloc(1, sizeof(VarList));
+    VarList *vl = arena_alloc(arena, sizeof(VarList));
     vl->var = var;
 
     if (is_local)
@@ -25,72 +64,59 @@ Var *push_var(char *name, Type *ty, bool is_local)
         vl->next = globals;
         globals = vl;
     }
-    return var;
-}
 
-// 次のトークンが期待している記号のときには、トークンを1つ読み進めて
-// 真を返す。それ以外の場合には偽を返す。
-bool consume(char *op)
-{
-    if (token->kind != TK_RESERVED ||
-        strlen(op) != token->len ||
-        memcmp(token->str, op, token->len))
-        return false;
-    token = token->next;
-    return true;
+    VarScope *vs = arena_alloc(arena, sizeof(VarScope));
+    vs->var = var;
+    vs->shadowed = hashmap_get(&var_map, name);
+    vs->next = scope->vars;
+    scope->vars = vs;
+    hashmap_put(&var_map, name, var);
+    return var;
 }
 
-bool consume_return()
+// 次のトークンが期待している記号またはキーワードのときには、
+// トークンを1つ読み進めて真を返す。それ以外の場合には偽を返す。
+bool consume(TokenKind kind)
 {
-    if (token->kind != TK_RETURN)
+    if (token->kind != kind)
         return false;
-    token = token->next;
+    next_token();
     return true;
 }
 
-Token *consume_ident()
-{
-    if (token->kind != TK_IDENT)
-        return NULL;
-    Token *t = token;
-    token = token->next;
-    return t;
-}
-
-Token *consume_sizeof()
-{
-    if (token->kind != TK_RESERVED || token->len != 6 || memcmp(token->str, "sizeof", 6))
-        return NULL;
-    Token *t = token;
-    token = token->next;
-    return t;
-}
-
 char *expect_ident()
 {
-    Token *tk = consume_ident();
-    if (!tk)
+    if (token->kind != TK_IDENT)
         error_at(token->str, "識別子ではありません");
-
-    char *s = calloc(tk->len + 1, sizeof(char));
-    strncpy(s, tk->str, tk->len);
-    s[tk->len] = '\0';
-    return s;
+    char *name = token->name;
+    next_token();
+    return name;
 }
 
 Node *new_node(NodeKind kind, Node *lhs, Node *rhs)
 {
-    Node *node = calloc(1, sizeof(Node));
+    Node *node = arena_alloc(&node_arena, sizeof(Node));
     node->kind = kind;
+    node->line_no = lhs ? lhs->line_no : token->line_no;
     node->lhs = lhs;
     node->rhs = rhs;
     return node;
 }
 
+// 式のノードを作り、型を付ける。型の誤りはtokの位置で報告する
+Node *new_expr(NodeKind kind, Node *lhs, Node *rhs, Token *tok)
+{
+    Node *node = new_node(kind, lhs, rhs);
+    add_type(node, tok);
+    return node;
+}
+
 Node *new_node_num(int val)
 {
-    Node *node = calloc(1, sizeof(Node));
+    Node *node = arena_alloc(&node_arena, sizeof(Node));
     node->kind = ND_NUM;
+    node->line_no = token->line_no;
+    node->ty = int_type();
     node->val = val;
     return node;
 }
@@ -99,9 +125,13 @@ Node *new_var(Var *var)
 {
     Node *node = new_node(ND_LVAR, NULL, NULL);
     node->var = var;
+    node->ty = var->ty;
     return node;
 }
 
+// 関数名から戻り値の型を引く表。まだ定義されていない関数はintを返すものとみなす
+static HashMap fn_types;
+
 Function *function();
 Type *basetype();
 void global_var();
@@ -120,10 +150,10 @@ Node *postfix();
 
 bool is_function()
 {
-    Token *tok = token;
+    long pos = mark_token();
     basetype();
-    bool isFunc = consume_ident() && consume("(");
-    token = tok;
+    bool isFunc = consume(TK_IDENT) && consume(TK_LPAREN);
+    rewind_token(pos);
     return isFunc;
 }
 
@@ -134,10 +164,11 @@ Node *equality()
 
     for (;;)
     {
-        if (consume("=="))
-            node = new_node(ND_EQ, node, relational());
-        else if (consume("!="))
-            node = new_node(ND_NE, node, relational());
+        Token tok = *token;
+        if (consume(TK_EQ))
+            node = new_expr(ND_EQ, node, relational(), &tok);
+        else if (consume(TK_NE))
+            node = new_expr(ND_NE, node, relational(), &tok);
         else
             return node;
     }
@@ -150,14 +181,15 @@ Node *relational()
 
     for (;;)
     {
-        if (consume("<"))
-            node = new_node(ND_LT, node, add());
-        else if (consume("<="))
-            node = new_node(ND_LE, node, add());
-        else if (consume(">"))
-            node = new_node(ND_LT, add(), node);
-        else if (consume(">="))
-            node = new_node(ND_LE, add(), node);
+        Token tok = *token;
+        if (consume(TK_LT))
+            node = new_expr(ND_LT, node, add(), &tok);
+        else if (consume(TK_LE))
+            node = new_expr(ND_LE, node, add(), &tok);
+        else if (consume(TK_GT))
+            node = new_expr(ND_LT, add(), node, &tok);
+        else if (consume(TK_GE))
+            node = new_expr(ND_LE, add(), node, &tok);
         else
             return node;
     }
@@ -170,10 +202,11 @@ Node *add()
 
     for (;;)
     {
-        if (consume("+"))
-            node = new_node(ND_ADD, node, mul());
-        else if (consume("-"))
-            node = new_node(ND_SUB, node, mul());
+        Token tok = *token;
+        if (consume(TK_PLUS))
+            node = new_expr(ND_ADD, node, mul(), &tok);
+        else if (consume(TK_MINUS))
+            node = new_expr(ND_SUB, node, mul(), &tok);
         else
             return node;
     }
@@ -186,59 +219,51 @@ Node *mul()
 
     for (;;)
     {
-        if (consume("*"))
-            node = new_node(ND_MUL, node, unary());
-        else if (consume("/"))
-            node = new_node(ND_DIV, node, unary());
+        Token tok = *token;
+        if (consume(TK_STAR))
+            node = new_expr(ND_MUL, node, unary(), &tok);
+        else if (consume(TK_SLASH))
+            node = new_expr(ND_DIV, node, unary(), &tok);
         else
             return node;
     }
 }
 
+// 最も内側のスコープから見える変数を返す
 Var *find_lvar(Token *tok)
 {
-    for (VarList *vl = locals; vl; vl = vl->next)
-    {
-        Var *var = vl->var;
-        if (strlen(var->name) == tok->len && !memcmp(tok->str, var->name, tok->len))
-            return var;
-    }
-
-    for (VarList *vl = globals; vl; vl = vl->next)
-    {
-        Var *var = vl->var;
-        if (strlen(var->name) == tok->len && !memcmp(tok->str, var->name, tok->len))
-            return var;
-    }
-
-    return NULL;
+    return hashmap_get(&var_map, tok->name);
 }
 
-// basetype = ("char" | "int") "*"*
+// basetype = ("char" | "int" | "long") "*"*
 Type *basetype()
 {
     Type *ty;
-    if (consume("char"))
+    if (consume(TK_CHAR))
     {
         ty = char_type();
     }
+    else if (consume(TK_LONG))
+    {
+        ty = long_type();
+    }
     else
     {
-        expect("int");
+        expect(TK_INT);
         ty = int_type();
     }
 
-    while (consume("*"))
+    while (consume(TK_STAR))
         ty = pointer_to(ty);
     return ty;
 }
 
 Type *read_type_suffix(Type *base)
 {
-    if (!consume("["))
+    if (!consume(TK_LBRACKET))
         return base;
     int sz = expect_number();
-    expect("]");
+    expect(TK_RBRACKET);
     base = read_type_suffix(base);
     return array_of(base, sz);
 }
@@ -248,22 +273,22 @@ VarList *read_func_param()
     Type *ty = basetype();
     char *name = expect_ident();
     ty = read_type_suffix(ty);
-    VarList *vl = calloc(1, sizeof(VarList));
+    VarList *vl = arena_alloc(&node_arena, sizeof(VarList));
     vl->var = push_var(name, ty, true);
     return vl;
 }
 
 VarList *read_func_params()
 {
-    if (consume(")"))
+    if (consume(TK_RPAREN))
         return NULL;
 
     VarList *head = read_func_param();
     VarList *cur = head;
 
-    while (!consume(")"))
+    while (!consume(TK_RPAREN))
     {
-        expect(",");
+        expect(TK_COMMA);
         cur->next = read_func_param();
         cur = cur->next;
     }
@@ -275,51 +300,54 @@ VarList *read_func_params()
 Node *funcall(Token *tok)
 {
     Node *node = new_node(ND_FUNCALL, NULL, NULL);
-    node->funcname = calloc(tok->len + 1, sizeof(char));
-    strncpy(node->funcname, tok->str, tok->len);
-    node->funcname[tok->len] = '\0';
+    node->line_no = tok->line_no;
+    node->funcname = tok->name;
 
-    int i = 0;
-    while (!consume(")"))
+    Node head = {};
+    Node *cur = &head;
+    while (!consume(TK_RPAREN))
     {
-        node->args[i++] = assign();
-        consume(",");
+        cur = cur->next = assign();
+        consume(TK_COMMA);
     }
-    node->args[i] = NULL;
+    node->args = head.next;
+    node->ty = hashmap_get(&fn_types, node->funcname);
+    if (!node->ty)
+        node->ty = int_type();
     return node;
 }
 
 // primary = "(" expr ")" | "sizeof" unary | ident func-args? | num
 Node *primary()
 {
-    Token *tok;
     // 次のトークンが"("なら、"(" expr ")"のはず
-    if (consume("("))
+    if (consume(TK_LPAREN))
     {
         Node *node = expr();
-        expect(")");
+        expect(TK_RPAREN);
         return node;
     }
-    if (tok = consume_sizeof())
-        return new_node(ND_SIZEOF, unary(), NULL);
-    if (tok = consume_ident())
+    if (consume(TK_SIZEOF))
+        return new_node_num(size_of(unary()->ty));
+    Token tok = *token;
+    if (consume(TK_IDENT))
     {
-        if (consume("("))
+        if (consume(TK_LPAREN))
         {
-            return funcall(tok);
+            return funcall(&tok);
         }
-        Node *node = calloc(1, sizeof(Node));
-        node->kind = ND_LVAR;
-
-        Var *var = find_lvar(tok);
+        Var *var = find_lvar(&tok);
         if (!var)
-            error_at(tok->str, "変数が見つかりません");
-        node->var = var;
+            error_at(tok.str, "変数が見つかりません");
+        Node *node = new_var(var);
+        node->line_no = tok.line_no;
         return node;
     }
 
     // そうでなければ数値のはず
-    return new_node_num(expect_number());
+    Node *node = new_node_num(expect_number());
+    node->line_no = tok.line_no;
+    return node;
 }
 
 // postfix = primary ("[" expr "]")*
@@ -327,38 +355,40 @@ Node *postfix()
 {
     Node *node = primary();
 
-    while (consume("["))
+    for (;;)
     {
+        Token tok = *token;
+        if (!consume(TK_LBRACKET))
+            return node;
         // x[y] is short for *(x+y)
-        Node *exp = new_node(ND_ADD, node, expr());
-        expect("]");
-        node = new_node(ND_DEREF, exp, NULL);
+        Node *exp = new_expr(ND_ADD, node, expr(), &tok);
+        expect(TK_RBRACKET);
+        node = new_expr(ND_DEREF, exp, NULL, &tok);
     }
-    return node;
 }
 
 // unary   = ("+" | "-" | "*" | "&")? unary | postfix
 Node *unary()
 {
-    if (consume("+"))
+    if (consume(TK_PLUS))
         return unary();
-    if (consume("-"))
-        return new_node(ND_SUB, new_node_num(0), unary());
-    if (consume("&"))
-        return new_node(ND_ADDR, unary(), NULL);
-    if (consume("*"))
-        return new_node(ND_DEREF, unary(), NULL);
+    Token tok = *token;
+    if (consume(TK_MINUS))
+        return new_expr(ND_SUB, new_node_num(0), unary(), &tok);
+    if (consume(TK_AMP))
+        return new_expr(ND_ADDR, unary(), NULL, &tok);
+    if (consume(TK_STAR))
+        return new_expr(ND_DEREF, unary(), NULL, &tok);
     return postfix();
 }
 
-Node *code[100];
-
 // assign  = equality ("=" assign)?
 Node *assign()
 {
     Node *node = equality();
-    if (consume("="))
-        node = new_node(ND_ASSIGN, node, assign());
+    Token tok = *token;
+    if (consume(TK_ASSIGN))
+        node = new_expr(ND_ASSIGN, node, assign(), &tok);
     return node;
 }
 
@@ -372,19 +402,19 @@ Node *expr()
 Node *compound_stmt()
 {
     Node *node = new_node(ND_BLOCK, NULL, NULL);
-    int i = 0;
-    while (!consume("}"))
-    {
-        node->body[i] = stmt();
-        i++;
-    }
-    node->body[i] = NULL;
+    Node head = {};
+    Node *cur = &head;
+    enter_scope();
+    while (!consume(TK_RBRACE))
+        cur = cur->next = stmt();
+    leave_scope();
+    node->body = head.next;
     return node;
 }
 
 bool is_typename()
 {
-    return peek("int") || peek("char");
+    return peek(TK_INT) || peek(TK_CHAR) || peek(TK_LONG);
 }
 
 // stmt = expr ";"
@@ -394,64 +424,75 @@ bool is_typename()
 // | "for" "(" expr-stmt expr? ";" expr? ")" stmt
 // | "while" "(" expr ")" stmt
 // | declaration
+static Node *stmt2();
+
 Node *stmt()
+{
+    // -gの行番号情報は文の単位で出力するので、文の先頭の行を記録する
+    int line_no = token->line_no;
+    Node *node = stmt2();
+    node->line_no = line_no;
+    return node;
+}
+
+static Node *stmt2()
 {
     Node *node;
 
-    if (consume_return())
+    if (consume(TK_RETURN))
     {
         Node *n = expr();
         node = new_node(ND_RETURN, n, NULL);
-        expect(";");
+        expect(TK_SEMI);
         return node;
     }
-    else if (consume("if"))
+    else if (consume(TK_IF))
     {
         Node *node = new_node(ND_IF, NULL, NULL);
-        expect("(");
+        expect(TK_LPAREN);
         node->cond = expr();
-        expect(")");
+        expect(TK_RPAREN);
         node->then = stmt();
-        if (consume("else"))
+        if (consume(TK_ELSE))
             node->els = stmt();
         return node;
     }
-    else if (consume("for"))
+    else if (consume(TK_FOR))
     {
         Node *node = new_node(ND_FOR, NULL, NULL);
-        expect("(");
-        if (!consume(";"))
+        expect(TK_LPAREN);
+        if (!consume(TK_SEMI))
         {
             node->init = expr();
-            expect(";");
+            expect(TK_SEMI);
         }
 
-        if (!consume(";"))
+        if (!consume(TK_SEMI))
         {
             node->cond = expr();
-            expect(";");
+            expect(TK_SEMI);
         }
 
-        if (!consume(")"))
+        if (!consume(TK_RPAREN))
         {
             node->inc = expr();
-            expect(")");
+            expect(TK_RPAREN);
         }
 
         node->then = stmt();
 
         return node;
     }
-    else if (consume("while"))
+    else if (consume(TK_WHILE))
     {
         Node *node = new_node(ND_FOR, NULL, NULL);
-        expect("(");
+        expect(TK_LPAREN);
         node->cond = expr();
-        expect(")");
+        expect(TK_RPAREN);
         node->then = stmt();
         return node;
     }
-    else if (consume("{"))
+    else if (consume(TK_LBRACE))
     {
         return compound_stmt();
     }
@@ -462,7 +503,7 @@ Node *stmt()
     else
     {
         node = expr();
-        expect(";");
+        expect(TK_SEMI);
         return node;
     }
 }
@@ -473,18 +514,19 @@ Node *stmt()
 Function *function()
 {
     locals = NULL;
-    Function *fn = calloc(1, sizeof(Function));
-    basetype();
+    Function *fn = arena_alloc(&node_arena, sizeof(Function));
+    fn->ty = basetype();
     fn->name = expect_ident();
-    expect("(");
+    // 再帰呼び出しと後に続く関数からの呼び出しのために、本体より先に登録する
+    hashmap_put(&fn_types, fn->name, fn->ty);
+    expect(TK_LPAREN);
+    enter_scope();
     fn->params = read_func_params();
-    expect("{");
-    Node *stmts = compound_stmt();
-    for (int i = 0; stmts->body[i]; i++)
-    {
-        fn->body[i] = stmts->body[i];
-    }
+    expect(TK_LBRACE);
+    fn->body = compound_stmt()->body;
+    leave_scope();
     fn->locals = locals;
+    return fn;
 }
 
 // global-var = basetype ident ("[" num "]")* ";"
@@ -493,7 +535,7 @@ void global_var()
     Type *ty = basetype();
     char *name = expect_ident();
     ty = read_type_suffix(ty);
-    expect(";");
+    expect(TK_SEMI);
     push_var(name, ty, false);
 }
 
@@ -504,38 +546,42 @@ Node *declaration()
     char *name = expect_ident();
     ty = read_type_suffix(ty);
     Var *var = push_var(name, ty, true);
-    if (consume(";"))
+    if (consume(TK_SEMI))
         return new_node(ND_NULL, NULL, NULL);
 
-    expect("=");
+    Token tok = *token;
+    expect(TK_ASSIGN);
     Node *lhs = new_var(var);
     Node *rhs = expr();
-    expect(";");
-    Node *node = new_node(ND_ASSIGN, lhs, rhs);
+    expect(TK_SEMI);
+    Node *node = new_expr(ND_ASSIGN, lhs, rhs, &tok);
     return new_node(ND_EXPR_STMT, node, NULL);
 }
 
-// program = (global-var | function)*
-Program *program()
+// 次の関数の定義までを読み、その関数を返す。途中のグローバル変数は
+// prog->globalsに加える。入力の終わりに達したらNULLを返す。
+Function *next_function(Program *prog)
 {
-    // consume("{");
-    Function head = {};
-    Function *cur = &head;
-    globals = NULL;
-    while (!at_eof())
+    Function *fn = NULL;
+    while (!fn && !at_eof())
     {
         if (is_function())
-        {
-            cur->next = function();
-            cur = cur->next;
-        }
+            fn = function();
         else
-        {
             global_var();
-        }
     }
-    Program *prog = calloc(1, sizeof(Program));
     prog->globals = globals;
+    return fn;
+}
+
+// program = (global-var | function)*
+Program *program()
+{
+    Program *prog = arena_alloc(&node_arena, sizeof(Program));
+    Function head = {};
+    Function *cur = &head;
+    while ((cur->next = next_function(prog)))
+        cur = cur->next;
     prog->fns = head.next;
     return prog;
 }
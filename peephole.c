@@ -0,0 +1,962 @@
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "9cc.h"
+
+// 覗き穴最適化。
+// コード生成器が関数1つ分の命令をemit_insnで1つずつ記録していき、
+// 関数の終わりで規則の表を変化がなくなるまで繰り返し適用してから出力する。
+// レジスタの生死は、ジャンプをたどって後続の命令を調べることで判定する。
+
+typedef struct
+{
+    char *text;  // 疑似命令ならその行
+    char *op;    // 命令名。ラベルと疑似命令ではNULL
+    char *dst;   // 第1オペランド
+    char *src;   // 第2オペランド
+    char *label; // ラベル行ならそのラベル名
+    int opc;     // 命令の種類 (OP_*)
+    int dst_reg; // オペランドがレジスタならその番号、そうでなければ-1
+    int src_reg;
+    int target;  // ジャンプ命令なら飛び先の行番号。見つからなければ-1
+    uint32_t uses;
+    uint32_t defs;
+    bool dead;
+} Insn;
+
+static Insn *insns;
+static int ninsns;
+static int *visited;
+static int visit_gen;
+
+// 疑似命令の行と書き換えで作った文字列の置き場所。関数ごとに空にする
+static Arena peephole_arena = {"peephole"};
+
+static long insns_before;
+static long insns_after;
+
+//
+// レジスタ
+//
+
+enum
+{
+    RAX,
+    RBX,
+    RCX,
+    RDX,
+    RSI,
+    RDI,
+    RBP,
+    RSP,
+    R8,
+    R9,
+    R10,
+    R11,
+    R12,
+    R13,
+    R14,
+    R15,
+    NUM_REGS,
+};
+
+#define BIT(r) (1u << (r))
+#define ALL_REGS ((1u << NUM_REGS) - 1)
+#define ARG_REGS (BIT(RDI) | BIT(RSI) | BIT(RDX) | BIT(RCX) | BIT(R8) | BIT(R9))
+#define CALLER_SAVED (ARG_REGS | BIT(RAX) | BIT(R10) | BIT(R11))
+#define CALLEE_SAVED (BIT(RBX) | BIT(RBP) | BIT(R12) | BIT(R13) | BIT(R14) | BIT(R15))
+
+// ax, bx, ..., sp の2文字からレジスタ番号を求める
+static int reg_of2(char c1, char c2)
+{
+    switch (c1)
+    {
+    case 'a':
+        return c2 == 'x' ? RAX : -1;
+    case 'b':
+        return c2 == 'x' ? RBX : c2 == 'p' ? RBP : -1;
+    case 'c':
+        return c2 == 'x' ? RCX : -1;
+    case 'd':
+        return c2 == 'x' ? RDX : c2 == 'i' ? RDI : -1;
+    case 's':
+        return c2 == 'i' ? RSI : c2 == 'p' ? RSP : -1;
+    }
+    return -1;
+}
+
+// 名前からレジスタ番号を求める。幅の違う名前(rax/eax/ax/al)は同じ番号になる。
+static int reg_of(char *s, int len)
+{
+    if (len < 2 || len > 4)
+        return -1;
+
+    // r8〜r15。接尾辞d/w/bは幅を表す
+    if (s[0] == 'r' && isdigit(s[1]))
+    {
+        int n = s[1] - '0';
+        int i = 2;
+        if (i < len && isdigit(s[i]))
+            n = n * 10 + s[i++] - '0';
+        if (i < len && (s[i] == 'd' || s[i] == 'w' || s[i] == 'b'))
+            i++;
+        return i == len && 8 <= n && n <= 15 ? R8 + n - 8 : -1;
+    }
+
+    // rax/eax/ax は先頭のr/eを除いた2文字、al/sil は末尾のlを除いた部分で決まる
+    if (len == 3 && (s[0] == 'r' || s[0] == 'e'))
+        return reg_of2(s[1], s[2]);
+    if (len == 2 && s[1] == 'l')
+        return strchr("abcd", s[0]) ? reg_of2(s[0], 'x') : -1;
+    if (len == 2)
+        return reg_of2(s[0], s[1]);
+    if (len == 3 && s[2] == 'l')
+    {
+        int r = reg_of2(s[0], s[1]);
+        return r >= RSI ? r : -1;
+    }
+    return -1;
+}
+
+static bool is_word(char c)
+{
+    return ('a' <= c && c <= 'z') || ('A' <= c && c <= 'Z') || ('0' <= c && c <= '9');
+}
+
+// オペランドの中に現れるレジスタの集合
+static uint32_t regs_in(char *opnd)
+{
+    uint32_t set = 0;
+    if (!opnd)
+        return set;
+
+    for (char *p = opnd; *p;)
+    {
+        if (!is_word(*p))
+        {
+            p++;
+            continue;
+        }
+        char *q = p;
+        while (is_word(*q) || *q == '_' || *q == '.')
+            q++;
+        int r = reg_of(p, q - p);
+        if (r >= 0)
+            set |= BIT(r);
+        p = q;
+    }
+    return set;
+}
+
+static bool is_mem(char *opnd)
+{
+    return opnd && strchr(opnd, '[');
+}
+
+// 32ビット符号付き即値として命令に埋め込める整数か
+static bool is_imm32(char *opnd)
+{
+    if (!opnd || !(isdigit(*opnd) || (*opnd == '-' && isdigit(opnd[1]))))
+        return false;
+    char *end;
+    long val = strtol(opnd, &end, 10);
+    return !*end && INT32_MIN <= val && val <= INT32_MAX;
+}
+
+//
+// 命令の分類
+//
+
+// 命令の種類ごとのオペランドの読み書き
+enum
+{
+    R_DST = 1, // 第1オペランドを読む
+    W_DST = 2, // 第1オペランドに書く
+    R_SRC = 4, // 第2オペランドを読む
+    UNKNOWN = 8,
+};
+
+enum
+{
+    OP_MOV,
+    OP_MOVSX,
+    OP_MOVSXD,
+    OP_MOVZX,
+    OP_MOVZB,
+    OP_LEA,
+    OP_ADD,
+    OP_SUB,
+    OP_IMUL,
+    OP_AND,
+    OP_OR,
+    OP_XOR,
+    OP_SHL,
+    OP_SAR,
+    OP_SHR,
+    OP_NEG,
+    OP_CMP,
+    OP_TEST,
+    OP_PUSH,
+    OP_POP,
+    OP_IDIV,
+    OP_CQO,
+    OP_JMP,
+    OP_CALL,
+    OP_RET,
+    OP_JCC,   // je, jne, ...
+    OP_SETCC, // sete, setne, ...
+    OP_OTHER, // 知らない命令。レジスタをすべて読むものとみなす
+    OP_NONE,  // ラベルと疑似命令
+};
+
+static struct
+{
+    char *name;
+    int flags;
+} op_table[] = {
+    [OP_MOV] = {"mov", W_DST | R_SRC},
+    [OP_MOVSX] = {"movsx", W_DST | R_SRC},
+    [OP_MOVSXD] = {"movsxd", W_DST | R_SRC},
+    [OP_MOVZX] = {"movzx", W_DST | R_SRC},
+    [OP_MOVZB] = {"movzb", W_DST | R_SRC},
+    [OP_LEA] = {"lea", W_DST | R_SRC},
+    [OP_ADD] = {"add", R_DST | W_DST | R_SRC},
+    [OP_SUB] = {"sub", R_DST | W_DST | R_SRC},
+    [OP_IMUL] = {"imul", R_DST | W_DST | R_SRC},
+    [OP_AND] = {"and", R_DST | W_DST | R_SRC},
+    [OP_OR] = {"or", R_DST | W_DST | R_SRC},
+    [OP_XOR] = {"xor", R_DST | W_DST | R_SRC},
+    [OP_SHL] = {"shl", R_DST | W_DST | R_SRC},
+    [OP_SAR] = {"sar", R_DST | W_DST | R_SRC},
+    [OP_SHR] = {"shr", R_DST | W_DST | R_SRC},
+    [OP_NEG] = {"neg", R_DST | W_DST},
+    [OP_CMP] = {"cmp", R_DST | R_SRC},
+    [OP_TEST] = {"test", R_DST | R_SRC},
+    [OP_PUSH] = {"push", R_DST},
+    [OP_POP] = {"pop", W_DST},
+    [OP_IDIV] = {"idiv", R_DST},
+    [OP_CQO] = {"cqo", 0},
+    [OP_JMP] = {"jmp", 0},
+    [OP_CALL] = {"call", 0},
+    [OP_RET] = {"ret", 0},
+    [OP_JCC] = {NULL, 0},
+    [OP_SETCC] = {NULL, R_DST | W_DST}, // 下位8ビットだけ書き換える
+    [OP_OTHER] = {NULL, UNKNOWN},
+    [OP_NONE] = {NULL, 0},
+};
+
+static int opcode(char *op)
+{
+    if (!op)
+        return OP_NONE;
+    for (int i = 0; i < OP_JCC; i++)
+        if (op_table[i].name[0] == op[0] && !strcmp(op_table[i].name, op))
+            return i;
+    if (op[0] == 'j')
+        return OP_JCC;
+    if (!strncmp(op, "set", 3))
+        return OP_SETCC;
+    return OP_OTHER;
+}
+
+static bool is_jump(Insn *in)
+{
+    return in->opc == OP_JMP || in->opc == OP_JCC;
+}
+
+static bool is_control(Insn *in)
+{
+    return is_jump(in) || in->opc == OP_CALL || in->opc == OP_RET;
+}
+
+// オペランドを1回だけ走査して分かること
+typedef struct
+{
+    int reg;       // レジスタそのものならその番号、そうでなければ-1
+    uint32_t regs; // 現れるレジスタの集合
+    bool mem;      // メモリ参照か
+} Opnd;
+
+static Opnd scan_opnd(char *s)
+{
+    Opnd op = {-1, 0, false};
+    if (!s)
+        return op;
+    char *p = strchr(s, '[');
+    if (p)
+    {
+        op.mem = true;
+        op.regs = regs_in(p);
+        return op;
+    }
+    op.reg = reg_of(s, strlen(s));
+    if (op.reg >= 0)
+        op.regs = BIT(op.reg);
+    return op;
+}
+
+// 命令inが読むレジスタの集合をin->usesに、書くレジスタの集合をin->defsに求める
+static void effects(Insn *in, Opnd *dst, Opnd *src)
+{
+    uint32_t *uses = &in->uses;
+    uint32_t *defs = &in->defs;
+    *uses = 0;
+    *defs = 0;
+    if (in->opc == OP_NONE)
+        return;
+
+    int flags = op_table[in->opc].flags;
+    if (flags & UNKNOWN)
+    {
+        *uses = ALL_REGS;
+        return;
+    }
+
+    // メモリオペランドの中のレジスタはアドレス計算のために読まれる
+    if (dst->mem || (flags & R_DST))
+        *uses |= dst->regs;
+    if (!dst->mem && (flags & W_DST))
+        *defs |= dst->regs;
+    if (flags & R_SRC)
+        *uses |= src->regs;
+
+    if (in->opc == OP_PUSH || in->opc == OP_POP)
+    {
+        *uses |= BIT(RSP);
+        *defs |= BIT(RSP);
+    }
+    else if (in->opc == OP_CQO)
+    {
+        *uses |= BIT(RAX);
+        *defs |= BIT(RDX);
+    }
+    else if (in->opc == OP_IMUL && !in->src)
+    {
+        // 1オペランドのimulはrdx:rax = rax * dst
+        *defs = BIT(RAX) | BIT(RDX);
+        *uses |= BIT(RAX);
+    }
+    else if (in->opc == OP_IDIV)
+    {
+        *uses |= BIT(RAX) | BIT(RDX);
+        *defs |= BIT(RAX) | BIT(RDX);
+    }
+    else if (in->opc == OP_CALL)
+    {
+        *uses |= ARG_REGS | BIT(RAX) | BIT(RSP);
+        *defs |= CALLER_SAVED;
+    }
+    else if (in->opc == OP_RET)
+    {
+        *uses |= BIT(RAX) | CALLEE_SAVED | BIT(RSP);
+    }
+}
+
+// ラベル名から行番号を引くハッシュ表。オープンアドレス法で、空きは-1
+static int *label_tab;
+static int label_cap;
+static uint32_t label_mask;
+
+static uint32_t hash(char *s)
+{
+    uint32_t h = 2166136261u;
+    for (; *s; s++)
+        h = (h ^ (unsigned char)*s) * 16777619u;
+    return h;
+}
+
+static void index_labels()
+{
+    int n = 0;
+    for (int i = 0; i < ninsns; i++)
+        if (insns[i].label)
+            n++;
+
+    int cap = 16;
+    while (cap < n * 2)
+        cap *= 2;
+    if (cap > label_cap)
+    {
+        label_tab = realloc(label_tab, sizeof(int) * cap);
+        label_cap = cap;
+    }
+    label_mask = cap - 1;
+    for (int i = 0; i < cap; i++)
+        label_tab[i] = -1;
+
+    for (int i = 0; i < ninsns; i++)
+    {
+        if (!insns[i].label)
+            continue;
+        uint32_t h = hash(insns[i].label) & label_mask;
+        while (label_tab[h] >= 0)
+            h = (h + 1) & label_mask;
+        label_tab[h] = i;
+    }
+}
+
+static int find_label(char *name)
+{
+    for (uint32_t h = hash(name) & label_mask;; h = (h + 1) & label_mask)
+    {
+        int i = label_tab[h];
+        if (i < 0)
+            return -1;
+        if (!strcmp(insns[i].label, name))
+            return i;
+    }
+}
+
+// 命令ごとのレジスタの読み書きと飛び先は、記録し終えた時と書き換え時に求めておく
+static void analyze(Insn *in)
+{
+    Opnd dst = scan_opnd(in->dst);
+    Opnd src = scan_opnd(in->src);
+    in->opc = opcode(in->op);
+    in->dst_reg = dst.reg;
+    in->src_reg = src.reg;
+    effects(in, &dst, &src);
+    in->target = -1;
+    if (is_jump(in))
+        in->target = find_label(in->dst);
+}
+
+// i番目の命令から実行を始めたとき、レジスタrが書かれる前に読まれる
+// 可能性があるならtrueを返す。分からないときもtrueを返す。
+static bool live_from(int i, int r)
+{
+    for (; i < ninsns; i++)
+    {
+        if (visited[i] == visit_gen)
+            return false;
+        visited[i] = visit_gen;
+
+        Insn *in = &insns[i];
+        if (in->dead || !in->op)
+            continue;
+
+        if (in->uses & BIT(r))
+            return true;
+        if (in->defs & BIT(r))
+            return false;
+
+        if (in->opc == OP_RET)
+            return false;
+        if (is_jump(in))
+        {
+            int target = in->target;
+            if (target < 0)
+                return true;
+            if (in->opc == OP_JMP)
+            {
+                i = target - 1;
+                continue;
+            }
+            if (live_from(target, r))
+                return true;
+        }
+    }
+    // 関数の終わりまで来たら、呼び出し元が使うかもしれないとみなす
+    return true;
+}
+
+static bool is_dead_after(int i, int r)
+{
+    visit_gen++;
+    return !live_from(i + 1, r);
+}
+
+// i番目より後ろで、最初の有効な命令かラベルの位置を返す
+static int next_insn(int i)
+{
+    for (i++; i < ninsns; i++)
+    {
+        Insn *in = &insns[i];
+        if (in->dead)
+            continue;
+        if (in->op || in->label)
+            return i;
+    }
+    return -1;
+}
+
+static void kill(int i)
+{
+    insns[i].dead = true;
+}
+
+static void rewrite(int i, char *op, char *dst, char *src)
+{
+    insns[i].op = op;
+    insns[i].dst = dst;
+    insns[i].src = src;
+    analyze(&insns[i]);
+}
+
+static char *format(char *fmt, char *a, char *b)
+{
+    int len = snprintf(NULL, 0, fmt, a, b);
+    char *buf = arena_alloc(&peephole_arena, len + 1);
+    sprintf(buf, fmt, a, b);
+    return buf;
+}
+
+//
+// 規則
+//
+// それぞれi番目の命令を起点に適用を試み、書き換えたらtrueを返す。
+//
+
+// push X ... pop Y を mov Y, X にする。
+// 間にラベル、分岐、スタック操作、Xへの書き込みがないことが条件。
+static bool push_pop(int i)
+{
+    Insn *push = &insns[i];
+    if (push->opc != OP_PUSH || is_mem(push->dst))
+        return false;
+    int x = push->dst_reg;
+
+    for (int k = next_insn(i); k >= 0; k = next_insn(k))
+    {
+        Insn *in = &insns[k];
+        if (in->label || is_control(in))
+            return false;
+
+        if (in->opc == OP_POP)
+        {
+            if (is_mem(in->dst))
+                return false;
+            kill(i);
+            if (x >= 0 && in->dst_reg == x)
+                kill(k);
+            else
+                rewrite(k, "mov", in->dst, push->dst);
+            return true;
+        }
+
+        if ((in->uses | in->defs) & BIT(RSP))
+            return false;
+        if (x >= 0 && (in->defs & BIT(x)))
+            return false;
+    }
+    return false;
+}
+
+// push X; add rsp, 8 は何もしないのと同じ
+static bool push_drop(int i)
+{
+    int k = next_insn(i);
+    if (insns[i].opc != OP_PUSH || k < 0)
+        return false;
+    Insn *add = &insns[k];
+    if (add->opc != OP_ADD || strcmp(add->dst, "rsp") || strcmp(add->src, "8"))
+        return false;
+    kill(i);
+    kill(k);
+    return true;
+}
+
+// mov R, R と add/sub rsp, 0 を消す
+static bool useless(int i)
+{
+    Insn *in = &insns[i];
+    if (in->opc == OP_MOV && in->dst_reg >= 0 && !strcmp(in->dst, in->src))
+    {
+        kill(i);
+        return true;
+    }
+    if ((in->opc == OP_ADD || in->opc == OP_SUB) && !strcmp(in->dst, "rsp") &&
+        !strcmp(in->src, "0"))
+    {
+        kill(i);
+        return true;
+    }
+    return false;
+}
+
+// 直後のラベルへのjmpを消す
+static bool jump_to_next(int i)
+{
+    Insn *in = &insns[i];
+    if (in->opc != OP_JMP)
+        return false;
+    for (int k = next_insn(i); k >= 0 && insns[k].label; k = next_insn(k))
+    {
+        if (!strcmp(insns[k].label, in->dst))
+        {
+            kill(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+// 無条件のジャンプやretの後ろにある、ラベルまでの命令は実行されない
+static bool unreachable(int i)
+{
+    Insn *in = &insns[i];
+    if (in->opc != OP_JMP && in->opc != OP_RET)
+        return false;
+
+    bool changed = false;
+    for (int k = next_insn(i); k >= 0 && !insns[k].label; k = next_insn(k))
+    {
+        kill(k);
+        changed = true;
+    }
+    return changed;
+}
+
+// mov R, imm; op D, R を op D, imm にする (以後Rが使われない場合)
+static bool fold_imm(int i)
+{
+    Insn *mov = &insns[i];
+    if (mov->opc != OP_MOV || !is_imm32(mov->src))
+        return false;
+    int r = mov->dst_reg;
+    if (r < 0)
+        return false;
+
+    int k = next_insn(i);
+    if (k < 0 || !insns[k].op)
+        return false;
+    Insn *in = &insns[k];
+
+    static int ops[] = {OP_ADD, OP_SUB, OP_IMUL, OP_CMP, OP_AND, OP_OR, OP_XOR, OP_MOV};
+    if (in->opc == OP_PUSH && in->dst_reg == r)
+    {
+        if (!is_dead_after(k, r))
+            return false;
+        rewrite(k, "push", mov->src, NULL);
+        kill(i);
+        return true;
+    }
+
+    for (int j = 0; j < sizeof(ops) / sizeof(*ops); j++)
+    {
+        if (in->opc != ops[j] || in->src_reg != r)
+            continue;
+        // メモリへのmovはオペランドサイズが決まらないので対象外
+        if (in->dst_reg < 0 || in->dst_reg == r)
+            return false;
+        if (!is_dead_after(k, r))
+            return false;
+        rewrite(k, in->op, in->dst, mov->src);
+        kill(i);
+        return true;
+    }
+    return false;
+}
+
+// opndが [reg] か byte ptr [reg] ならtrue
+static bool is_ref(char *opnd, char *reg)
+{
+    if (!opnd)
+        return false;
+    if (!strncmp(opnd, "byte ptr ", 9))
+        opnd += 9;
+    int len = strlen(reg);
+    return opnd[0] == '[' && !strncmp(opnd + 1, reg, len) && !strcmp(opnd + 1 + len, "]");
+}
+
+// lea R, M の後、Rを参照する最初の命令が mov D, [R] や mov [R], S なら
+// アドレスを直接埋め込む。間に挟まる命令はRにもMのレジスタにも
+// 書き込まないものに限る。
+static bool fold_addr(int i)
+{
+    Insn *lea = &insns[i];
+    if (lea->opc != OP_LEA)
+        return false;
+    int r = lea->dst_reg;
+    if (r < 0)
+        return false;
+    uint32_t addr_regs = regs_in(lea->src);
+
+    int k = next_insn(i);
+    for (; k >= 0; k = next_insn(k))
+    {
+        Insn *in = &insns[k];
+        if (in->label || is_control(in))
+            return false;
+        if ((in->uses | in->defs) & BIT(r))
+            break;
+        if (in->defs & addr_regs)
+            return false;
+    }
+    if (k < 0)
+        return false;
+    Insn *in = &insns[k];
+
+    bool in_dst = is_ref(in->dst, lea->dst);
+    bool in_src = is_ref(in->src, lea->dst);
+    if (!(in->opc == OP_MOV || in->opc == OP_MOVSX) || in_dst == in_src)
+        return false;
+
+    // Rが他のオペランドに現れず、この命令の後で使われないこと
+    // (mov R, [R] のようにRを上書きする読み込みなら後続は気にしなくてよい)
+    bool overwrites = in_src && in->dst_reg == r;
+    char *other = in_dst ? in->src : in->dst;
+    if (!overwrites && (regs_in(other) & BIT(r)))
+        return false;
+    if (!overwrites && !is_dead_after(k, r))
+        return false;
+
+    char *opnd = in_dst ? in->dst : in->src;
+    char *addr = strncmp(opnd, "byte ptr ", 9) ? lea->src : format("byte ptr %s", lea->src, NULL);
+    if (in_dst)
+        rewrite(k, in->op, addr, in->src);
+    else
+        rewrite(k, in->op, in->dst, addr);
+    kill(i);
+    return true;
+}
+
+// mov R, X; mov D, R を mov D, X にする (以後Rが使われない場合)。
+// movsxで読み込んだ値のコピーも同様に畳み込む。
+static bool forward_copy(int i)
+{
+    Insn *def = &insns[i];
+    if (def->opc != OP_MOV && def->opc != OP_MOVSX)
+        return false;
+    int r = def->dst_reg;
+    int k = next_insn(i);
+    if (r < 0 || k < 0)
+        return false;
+
+    Insn *in = &insns[k];
+    if (in->opc != OP_MOV || !in->src || strcmp(in->src, def->dst))
+        return false;
+    int d = in->dst_reg;
+    if (d < 0 || d == r || !is_dead_after(k, r))
+        return false;
+
+    rewrite(k, def->op, in->dst, def->src);
+    kill(i);
+    return true;
+}
+
+static char *inverse_jcc(char *set)
+{
+    static char *table[][3] = {
+        // setcc, 条件が成り立つときのjcc, 成り立たないときのjcc
+        {"sete", "je", "jne"},
+        {"setne", "jne", "je"},
+        {"setl", "jl", "jge"},
+        {"setle", "jle", "jg"},
+        {"setg", "jg", "jle"},
+        {"setge", "jge", "jl"},
+    };
+    for (int i = 0; i < sizeof(table) / sizeof(*table); i++)
+        if (!strcmp(table[i][0], set))
+            return table[i][2];
+    return NULL;
+}
+
+static char *same_jcc(char *set)
+{
+    return set[3] == 'e' && set[4] == '\0' ? "je" : format("j%s", set + 3, NULL);
+}
+
+// setCC al; movzb R, al; cmp R, 0; je L を、フラグを直接使う
+// 条件ジャンプ1つにする
+static bool fuse_setcc(int i)
+{
+    Insn *set = &insns[i];
+    if (set->opc != OP_SETCC || strcmp(set->dst, "al") ||
+        !inverse_jcc(set->op))
+        return false;
+
+    int k1 = next_insn(i);
+    int k2 = k1 < 0 ? -1 : next_insn(k1);
+    int k3 = k2 < 0 ? -1 : next_insn(k2);
+    if (k3 < 0)
+        return false;
+    Insn *movzb = &insns[k1];
+    Insn *cmp = &insns[k2];
+    Insn *jcc = &insns[k3];
+
+    if (movzb->opc != OP_MOVZB || strcmp(movzb->src, "al"))
+        return false;
+    int r = movzb->dst_reg;
+    if (r < 0 || cmp->opc != OP_CMP || cmp->dst_reg != r || strcmp(cmp->src, "0"))
+        return false;
+    if (jcc->opc != OP_JCC || (strcmp(jcc->op, "je") && strcmp(jcc->op, "jne")))
+        return false;
+
+    // 0/1の値とalが分岐の両側で使われないこと
+    int target = jcc->target;
+    if (target < 0 || !is_dead_after(k3, r) || !is_dead_after(k3, RAX))
+        return false;
+    visit_gen++;
+    if (live_from(target, r) || live_from(target, RAX))
+        return false;
+
+    char *op = !strcmp(jcc->op, "je") ? inverse_jcc(set->op) : same_jcc(set->op);
+    rewrite(k3, op, jcc->dst, NULL);
+    kill(i);
+    kill(k1);
+    kill(k2);
+    return true;
+}
+
+// 以後使われないレジスタへの転送を消す
+static bool dead_def(int i)
+{
+    Insn *in = &insns[i];
+    int r = in->dst_reg;
+    if (r < 0 || r == RSP || r == RBP || !is_dead_after(i, r))
+        return false;
+    kill(i);
+    return true;
+}
+
+// mov M, R; mov R2, M の2つ目はメモリを読み直さずに mov R2, R でよい
+static bool forward_store(int i)
+{
+    Insn *st = &insns[i];
+    int k = next_insn(i);
+    if (!is_mem(st->dst) || st->src_reg < 0 || k < 0)
+        return false;
+
+    Insn *ld = &insns[k];
+    if (ld->opc != OP_MOV || !ld->src || strcmp(ld->src, st->dst) || ld->dst_reg < 0 ||
+        strlen(ld->dst) != strlen(st->src))
+        return false;
+
+    if (ld->dst_reg == st->src_reg)
+        kill(k);
+    else
+        rewrite(k, "mov", ld->dst, st->src);
+    return true;
+}
+
+// i番目の命令を起点にする規則を試し、書き換えたらtrueを返す
+static bool apply_rules(int i)
+{
+    switch (insns[i].opc)
+    {
+    case OP_PUSH:
+        return push_drop(i) || push_pop(i);
+    case OP_MOV:
+        return useless(i) || dead_def(i) || fold_imm(i) || forward_copy(i) ||
+               forward_store(i);
+    case OP_MOVSX:
+        return dead_def(i) || forward_copy(i);
+    case OP_MOVZB:
+        return dead_def(i);
+    case OP_ADD:
+    case OP_SUB:
+        return useless(i);
+    case OP_LEA:
+        return dead_def(i) || fold_addr(i);
+    case OP_SETCC:
+        return fuse_setcc(i);
+    case OP_JMP:
+        return jump_to_next(i) || unreachable(i);
+    case OP_RET:
+        return unreachable(i);
+    }
+    return false;
+}
+
+//
+// 記録と出力
+//
+
+static Insn *new_insn()
+{
+    static int cap;
+    if (ninsns == cap)
+    {
+        cap = cap ? cap * 2 : 256;
+        insns = realloc(insns, sizeof(Insn) * cap);
+        visited = realloc(visited, sizeof(int) * cap);
+    }
+    Insn *in = &insns[ninsns];
+    *in = (Insn){};
+    visited[ninsns] = 0;
+    ninsns++;
+    return in;
+}
+
+// 命令名とオペランドの文字列は写さずにそのまま持つので、
+// 関数の終わりまで書き換えずに残しておくこと
+void peephole_insn(char *op, char *dst, char *src)
+{
+    Insn *in = new_insn();
+    in->op = op;
+    in->dst = dst;
+    in->src = src;
+}
+
+void peephole_label(char *name)
+{
+    new_insn()->label = name;
+}
+
+void peephole_directive(char *text)
+{
+    new_insn()->text = arena_strndup(&peephole_arena, text, strlen(text));
+}
+
+static bool is_counted(Insn *in)
+{
+    return in->op && !in->dead;
+}
+
+// 記録した関数1つ分の命令を最適化してemitする。
+// 呼ばれる時点でemit_insnは記録をやめて、テキストを出力するようになっている。
+void peephole_flush()
+{
+    index_labels();
+    for (int i = 0; i < ninsns; i++)
+        analyze(&insns[i]);
+    visit_gen = 0;
+
+    for (int i = 0; i < ninsns; i++)
+        if (is_counted(&insns[i]))
+            insns_before++;
+
+    for (bool changed = true; changed;)
+    {
+        changed = false;
+        for (int i = 0; i < ninsns; i++)
+        {
+            if (insns[i].dead || !apply_rules(i))
+                continue;
+            // 書き換えで直前の命令にも規則が当てはまるようになることが多いので、
+            // 1つ前の命令からやり直す
+            changed = true;
+            int j = i - 1;
+            while (j >= 0 && (insns[j].dead || insns[j].opc == OP_NONE))
+                j--;
+            i = j < 0 ? -1 : j - 1;
+        }
+    }
+
+    for (int i = 0; i < ninsns; i++)
+    {
+        Insn *in = &insns[i];
+        if (in->dead)
+            continue;
+        if (is_counted(in))
+            insns_after++;
+        if (in->text)
+            emit("%s", in->text);
+        else if (in->label)
+            emit_label(in->label);
+        else
+            emit_insn(in->op, in->dst, in->src);
+    }
+
+    ninsns = 0;
+    arena_reset(&peephole_arena);
+}
+
+void print_peephole_stats()
+{
+    fprintf(stderr, "peephole: %ld -> %ld instructions (%+ld)\n",
+            insns_before, insns_after, insns_after - insns_before);
+}
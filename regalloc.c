@@ -0,0 +1,183 @@
+#include <stdlib.h>
+#include "9cc.h"
+
+// 仮想レジスタの割り当て (線形走査法)。
+// 命令を順にたどり、仮想レジスタが定義された時点で空いている実レジスタを
+// 割り当てる。空きがなければ、生存区間が最も遠くまで続くものをスタックに
+// 追い出す。--regallocを指定しなければ実レジスタは使わず、すべてスタックに
+// 置く。生存区間が終わったスタックの領域は、後から始まる区間で使い回す。
+// 変数に占有させたレジスタ(fn->var_regs)は割り当てに使わない。
+
+static Function *fn;
+static Reg *active[NREG];
+
+// 使い回せるスタックの領域のオフセット
+static int *free_slots;
+static int nfree;
+static int free_cap;
+static int frame_size;
+
+static int new_slot()
+{
+    frame_size += 8;
+    return frame_size;
+}
+
+static int take_slot()
+{
+    if (nfree > 0)
+        return free_slots[--nfree];
+    return new_slot();
+}
+
+static void give_slot(int offset)
+{
+    if (nfree == free_cap)
+    {
+        free_cap = free_cap ? free_cap * 2 : 64;
+        free_slots = realloc(free_slots, sizeof(int) * free_cap);
+    }
+    free_slots[nfree++] = offset;
+}
+
+// rに場所を割り当てる。preferが空いていればそれを使う
+static void alloc(Reg *r, Reg *prefer)
+{
+    if (opt_regalloc)
+    {
+        if (prefer && prefer->rn >= 0 && !prefer->fixed && !active[prefer->rn])
+        {
+            active[prefer->rn] = r;
+            r->rn = prefer->rn;
+            return;
+        }
+
+        for (int i = 0; i < NREG; i++)
+        {
+            if (!active[i] && !(fn->var_regs & (1 << i)))
+            {
+                active[i] = r;
+                r->rn = i;
+                fn->used_regs |= 1 << i;
+                return;
+            }
+        }
+
+        // 区間が最も遠くまで続くものを追い出す。追い出した区間は始まりから
+        // スタックに置くことになるので、使い回しではない新しい領域を与える。
+        int victim = -1;
+        for (int i = 0; i < NREG; i++)
+            if (active[i] && (victim < 0 || active[i]->last_use > active[victim]->last_use))
+                victim = i;
+        Reg *v = victim < 0 ? NULL : active[victim];
+        if (v && v->last_use > r->last_use)
+        {
+            v->rn = -1;
+            v->offset = new_slot();
+            active[victim] = r;
+            r->rn = victim;
+            return;
+        }
+    }
+
+    r->offset = take_slot();
+}
+
+static void release(Reg *r, int ic)
+{
+    if (!r || r->fixed || r->last_use != ic)
+        return;
+    if (r->rn >= 0)
+    {
+        if (active[r->rn] == r)
+            active[r->rn] = NULL;
+    }
+    else
+        give_slot(r->offset);
+}
+
+// 直後のIR_MOVで変数に移すだけの値なら、その変数のレジスタを返す。
+// 命令が変数を第2オペランドなどで読むなら、先に書き換えてしまうので使えない
+static Reg *coalesce(IR *ir)
+{
+    IR *next = ir->next;
+    Reg *r = ir->dst;
+    if (!next || next->kind != IR_MOV || next->a != r || r->last_use != r->def + 1)
+        return NULL;
+    Reg *v = next->dst;
+    if (ir->b == v || ir->idx == v)
+        return NULL;
+    for (int i = 0; i < ir->nargs; i++)
+        if (ir->args[i] == v)
+            return NULL;
+    return v;
+}
+
+// 1つの命令の中では、第1オペランドを解放してから結果を割り当て、
+// 残りのオペランドはその後で解放する。結果は第1オペランドと同じ場所に
+// なることはあっても、第2オペランドや引数と同じ場所になることはない。
+// 2オペランドのx86命令では、第1オペランドと結果が同じならmovが要らない。
+static void alloc_ir(IR *ir, int ic)
+{
+    release(ir->a, ic);
+    if (ir->dst && !ir->dst->fixed)
+    {
+        Reg *v = coalesce(ir);
+        if (v)
+            ir->dst->rn = v->rn;
+        else
+            alloc(ir->dst, ir->a);
+    }
+    if (ir->b != ir->a)
+        release(ir->b, ic);
+    if (ir->idx != ir->a && ir->idx != ir->b)
+        release(ir->idx, ic);
+    for (int i = 0; i < ir->nargs; i++)
+        release(ir->args[i], ic);
+    release(ir->dst, ic);
+}
+
+// 各仮想レジスタの生存区間を命令の通し番号で求める
+static void set_last_use(Reg *r, int ic)
+{
+    if (r)
+        r->last_use = ic;
+}
+
+static void compute_live_ranges()
+{
+    int ic = 0;
+    for (BB *bb = fn->bbs; bb; bb = bb->next)
+    {
+        for (IR *ir = bb->ir; ir; ir = ir->next, ic++)
+        {
+            if (ir->dst)
+                ir->dst->def = ir->dst->last_use = ic;
+            set_last_use(ir->a, ic);
+            set_last_use(ir->b, ic);
+            set_last_use(ir->idx, ic);
+            for (int i = 0; i < ir->nargs; i++)
+                set_last_use(ir->args[i], ic);
+        }
+    }
+}
+
+void alloc_regs(Program *prog)
+{
+    for (fn = prog->fns; fn; fn = fn->next)
+    {
+        compute_live_ranges();
+
+        frame_size = fn->stack_size;
+        nfree = 0;
+        for (int i = 0; i < NREG; i++)
+            active[i] = NULL;
+
+        int ic = 0;
+        for (BB *bb = fn->bbs; bb; bb = bb->next)
+            for (IR *ir = bb->ir; ir; ir = ir->next)
+                alloc_ir(ir, ic++);
+
+        fn->stack_size = frame_size;
+    }
+}
@@ -1,4 +1,7 @@
 #!/bin/bash
+# 引数はそのまま9ccに渡す (例: ./test.sh --regalloc)
+flags="$*"
+
 cat <<EOF | gcc -xc -c -o tmp2.o -
 int ret3() { return 3; }
 int ret5() { return 5; }
@@ -7,13 +10,14 @@ int sub(int x, int y) { return x-y; }
 int add6(int a, int b, int c, int d, int e, int f) {
   return a+b+c+d+e+f;
 }
+int sum3(int *x) { return x[0]+x[1]+x[2]; }
 EOF
 
 assert() {
   expected="$1"
   input="$2"
 
-  ./9cc "$input" > tmp.s
+  echo "$input" | ./9cc $flags - > tmp.s
   cc -o tmp tmp.s tmp2.o
   ./tmp
   actual="$?"
@@ -22,8 +26,10 @@ assert() {
     echo "✅️ $input => $actual"
   else
     echo "❌️ $input => $expected expected, but got $actual"
-    echo "log:"
-    cat log.txt
+    if [ -s log.txt ]; then
+      echo "log:"
+      cat log.txt
+    fi
     exit 1
   fi
 }
@@ -35,6 +41,15 @@ assert 41 'int main() { return 12 + 34 - 5 ; }'
 assert 47 'int main() { return 5+6*7; }'
 assert 15 'int main() { return 5*(9-6); }'
 assert 4 'int main() { return (3+5)/2; }'
+assert 14 'int main() { int x=100; return x/7; }'
+assert 2 'int main() { int x=0-100; return x/(0-40); }'
+assert 12 'int main() { int x=0-100; return 0-x/8; }'
+assert 25 'int main() { int x=100; return x/4; }'
+assert 50 'int main() { int x=0-100; return x/(0-2); }'
+assert 3 'int main() { int x=1000000007; return x/300000000; }'
+assert 45 'int main() { int x=5; return x*9; }'
+assert 40 'int main() { int x=5; return x*8; }'
+assert 35 'int main() { int x=5; return x*7; }'
 assert 10 'int main() { return -10+20; }'
 assert 10 'int main() { return - -10; }'
 assert 10 'int main() { return - - +10; }'
@@ -44,6 +59,9 @@ assert 1 'int main() { return 42==42; }'
 assert 1 'int main() { return 0!=1; }'
 assert 0 'int main() { return 42!=42; }'
 
+assert 32 'int main() { return (((((1+1)+(1+1))+((1+1)+(1+1)))+(((1+1)+(1+1))+((1+1)+(1+1))))+((((1+1)+(1+1))+((1+1)+(1+1)))+(((1+1)+(1+1))+((1+1)+(1+1))))); }'
+assert 242 'int main() { return ((((((1-2)+(3-4))-((5-6)+(ret3()-8)))+(((9-0)+(1-2))-((3-ret3())+(5-6))))-((((7-8)+(9-0))-((ret3()-2)+(3-4)))+(((5-6)+(7-ret3()))-((9-0)+(1-2)))))+(((((3-4)+(ret3()-6))-((7-8)+(9-0)))+(((1-ret3())+(3-4))-((5-6)+(7-8))))-((((ret3()-0)+(1-2))-((3-4)+(5-ret3())))+(((7-8)+(9-0))-((1-2)+(ret3()-4)))))); }'
+
 assert 1 'int main() { return 0<1; }'
 assert 0 'int main() { return 1<1; }'
 assert 0 'int main() { return 2<1; }'
@@ -65,13 +83,28 @@ assert 2 'int main() { int hoge=3; int fuga=1; return hoge-fuga; }'
 assert 2 'int main() { return 2; }'
 assert 3 'int main() { int a=3; return a; }'
 assert 4 'int main() { int hoge=3; int fuga=1; return hoge+fuga; }'
+assert 9 'int main() { int iff=2; int charx=3; int returns=4; return iff+charx+returns; }'
+assert 5 'int main() { int _for=1; int whiles=2; int sizeof1=2; return _for+whiles+sizeof1; }'
 
 assert 1 'int main() { return 1; 2; 3; }'
 assert 2 'int main() { 1; return 2; 3; }'
 assert 3 'int main() { 1; 2; return 3; }'
 assert 3 'int main() { {1; {2;} return 3;} }'
 
+# 1つのブロックに100文より多く書ける
+assert 150 "int main() { int x=0; $(printf 'x=x+1; %.0s' {1..150}) return x; }"
+assert 200 "int main() { int x=0; { $(printf 'x=x+2; %.0s' {1..100}) } return x; }"
+
 assert 3 'int main() { if (0) return 2; return 3; }'
+assert 2 'int main() { if (2*3-6+1) return 2; return 3; }'
+assert 1 'int main() { int i=7; for (i=1; 0; i=i+1) return 9; return i; }'
+assert 4 'int main() { int i=4; while (1-1) return 9; return i; }'
+assert 5 'int main() { int i=0; while (2>1) { i=i+1; if (i==5) return i; } return 0; }'
+assert 7 'int main() { int x=7; return x*1+0-0; }'
+assert 7 'int main() { int x=7; return 1*(0+x)/1; }'
+assert 0 'int main() { int x=7; return x*0; }'
+assert 3 'int main() { int x=3; return ret3()*0 + x; }'
+assert 5 'int main() { int x[3]; x[0]=1; x[1]=5; return *(x+1-1+1); }'
 assert 2 'int main() { if (1) return 2; return 3; }'
 assert 3 'int main() { if (1-1) return 2; return 3; }'
 assert 2 'int main() { if (2-1) return 2; return 3; }'
@@ -80,6 +113,19 @@ assert 3 'int main() { if (1) { 1; 2; return 3; } else { return 4; } }'
 
 assert 55 'int main() { int i=0; int j=0; for (i=0; i<=10; i=i+1) j=i+j; return j; }'
 assert 3 'int main() { for (;;) {return 3;} return 5; }'
+assert 28 'int main() { int a=1; int b=2; int c=3; int d=4; int e=5; int f=6; int g=7; return a+b+c+d+e+f+g; }'
+assert 90 'int main() { int i=0; int s=0; for (i=0; i<10; i=i+1) s=add(s, i*2); return s; }'
+assert 45 'int main() { int i=0; int j=0; int s=0; for (i=0; i<10; i=i+1) for (j=0; j<i; j=j+1) s=s+1; return s; }'
+assert 21 'int main() { return sum(1, 2, 3, 4, 5, 6); } int sum(int a, int b, int c, int d, int e, int f) { int t=a+b; t=t+c; return t+d+e+f; }'
+assert 10 'int main() { int x=7; int y=x; x=3; return x+y; }'
+assert 2 'int main() { int x=3; if ((x<2)==0) return 2; return 3; }'
+assert 3 'int main() { int x=1; if ((x<2)==0) return 2; return 3; }'
+assert 2 'int main() { int x=3; if (x!=0) return 2; return 3; }'
+assert 3 'int main() { int x=0; if (x) return 2; return 3; }'
+assert 2 'int main() { int x=1; int y=5; if ((x<2)==(y>4)) return 2; return 3; }'
+assert 3 'int main() { int x=1; int y=4; if ((x<2)==(y>4)) return 2; return 3; }'
+assert 4 'int main() { int i=0; int j=0; for (i=0; (i>=4)==0; i=i+1) j=j+1; return j; }'
+assert 10 'int main() { int i=0; for (i=0; 10>i; i=i+1) 0; return i; }'
 
 assert 10 'int main() { int i=0; while(i<10) { i=i+1; } return i; }'
 
@@ -95,14 +141,41 @@ assert 32 'int main() { return ret32(); } int ret32() { return 32; }'
 assert 7 'int main() { return add2(3,4); } int add2(int x, int y) { return x+y; }'
 assert 1 'int main() { return sub2(4,3); } int sub2(int x, int y) { return x-y; }'
 assert 55 'int main() { return fib(9); } int fib(int x) { if (x<=1) return 1; return fib(x-1) + fib(x-2); }'
+assert 26 'int add2(int x, int y) { return x+y; } int sq(int x) { return x*x; } int sumsq(int a, int b) { return add2(sq(a), sq(b)); } int abs1(int x) { if (x<0) return 0-x; return x; } int main() { int i; int s=0; for (i=0; i<10; i=i+1) s=add2(s, abs1(i-5)); return sumsq(s, 1)-600; }'
+assert 1 'int even(int n) { if (n==0) return 1; return odd(n-1); } int odd(int n) { if (n==0) return 0; return even(n-1); } int main() { return even(10); }'
+assert 7 'int down(int n) { if (n==0) return 7; return down(n-1); } int main() { return down(10000000); }'
+assert 1 'int even(int n) { if (n==0) return 1; return odd(n-1); } int odd(int n) { if (n==0) return 0; return even(n-1); } int main() { return even(10000000); }'
+assert 55 'int fibt(int n, int a, int b) { if (n==0) return a; return fibt(n-1, b, a+b); } int main() { return fibt(10, 0, 1); }'
+assert 8 'int get(int *p) { return *p; } int twice(int x) { int y=x*2; return get(&y); } int main() { return twice(4); }'
+assert 3 'long widen(int x) { return add(x, 1); } int main() { return widen(2); }'
+assert 2 'char narrow(int x) { return add(x, 256); } int main() { return narrow(2); }'
+assert 3 'int inc(int x) { x=x+1; return x; } int main() { int a=3; inc(a); return a; }'
+assert 10 'int first(int a, int b) { return a; } int main() { int x=1; int y=first(x=5, 7); return y+x; }'
+assert 2 'char lo(int x) { return x; } int main() { return lo(258); }'
+assert 11 'int get(int i) { int a[3]; a[0]=4; a[1]=5; a[2]=6; return a[i]; } int main() { return get(1)+get(2); }'
+assert 10 'int sum(int n) { int i; int s=0; for (i=1; i<=n; i=i+1) s=s+i; return s; } int main() { return sum(4); }'
+assert 45 'int a[10]; int main() { int i; int s=0; for (i=0; i<10; i=i+1) a[i]=i; for (i=0; i<10; i=i+1) s=s+a[i]; return s; }'
+assert 14 'int main() { int i; int s=0; for (i=0; i<4; i=i+1) s=s+i+1; return s+i; }'
+assert 10 'int main() { int i=4; int s=0; while (i!=0) { s=s+i; i=i-1; } return s+i; }'
+assert 3 'int main() { int i; for (i=0; i<0; i=i+1) return 9; return 3+i; }'
+assert 2 'int main() { int i; for (i=0; i<5; i=i+1) if (i==2) return i; return 9; }'
+assert 19 'int main() { int i=1; int s=0; while (i<=16) { s=s+i; i=i+i; } return s-12; }'
+assert 36 'int a[3][4]; int main() { int i; int j; int s=0; for (i=0; i<3; i=i+1) for (j=0; j<4; j=j+1) a[i][j]=i+j; for (i=0; i<3; i=i+1) for (j=0; j<4; j=j+1) s=s+a[i][j]; return s+6; }'
+assert 60 'int a[20]; int main() { int n=10; int k=2; int i; int s=0; for (i=0; i<n*k; i=i+1) a[i]=k*3; for (i=0; i<n; i=i+1) { s=s+a[i+n]; if (i==4) n=n-3; } return s+18; }'
+assert 21 'int main() { int x[6]; int i; int *p=x; for (i=0; i<6; i=i+1) x[i]=i+1; int s=0; for (i=0; i<6; i=i+1) { s=s+*p; p=p+1; } return s; }'
+assert 8 'int g; int bump() { g=g+1; return 0; } int main() { int i; int s=0; for (i=0; i<4; i=i+1) { bump(); s=s+g; } return s-2; }'
+assert 6 'int main() { char i; int s=0; for (i=0; i<120; i=i+100) { s=s+1; if (s>5) return s; } return s; }'
+assert 5 'int main() { char i; int s=0; for (i=300; i<50; i=i+2) s=s+1; return s+i-48; }'
+assert 60 'int f(int n) { int i; int s; s=0; for (i=0; i<n; i=i+1) s=s+i; return s; } int main() { int i; int s; int k; s=0; k=2; for (i=0; i<10; i=i+1) s=s+k*3; return s; }'
+assert 24 'int f(int n) { int i; int s=0; for (i=0; i<n; i=i+1) s=s+i; return s; } int g(int n) { int j=0; int t=1; while (j<n) { t=t+t; j=j+1; } return t; } int main() { int i; int k=3; int s=0; for (i=0; i<3; i=i+1) s=s+k; return s+f(4)+g(3)+i-2; }'
 
 assert 3 'int main() { int x=3; return *&x; }'
 assert 3 'int main() { int x=3; int* y=&x; int** z=&y; return **z; }'
-assert 5 'int main() { int x=3; int y=5; return *(&x+1); }'
-assert 3 'int main() { int x=3; int y=5; return *(&y-1); }'
+assert 5 'int main() { int x=3; int y=5; int *p=&y; return *(&x+1); }'
+assert 3 'int main() { int x=3; int y=5; int *p=&x; return *(&y-1); }'
 assert 5 'int main() { int x=3; int* y=&x; *y=5; return x; }'
-assert 7 'int main() { int x=3; int y=5; *(&x+1)=7; return y; }'
-assert 7 'int main() { int x=3; int y=5; *(&y-1)=7; return x; }'
+assert 7 'int main() { int x=3; int y=5; int *p=&y; *(&x+1)=7; return y; }'
+assert 7 'int main() { int x=3; int y=5; int *p=&x; *(&y-1)=7; return x; }'
 
 assert 3 'int main() { int x[2]; int *y=&x; *y=3; return *x; }'
 assert 3 'int main() { int x[3]; *x=3; *(x+1)=4; *(x+2)=5; return *x; }'
@@ -128,17 +201,22 @@ assert 3 'int main() { int x[2][3]; int *y=x; y[3]=3; return x[1][0]; }'
 assert 4 'int main() { int x[2][3]; int *y=x; y[4]=4; return x[1][1]; }'
 assert 5 'int main() { int x[2][3]; int *y=x; y[5]=5; return x[1][2]; }'
 assert 6 'int main() { int x[2][3]; int *y=x; y[6]=6; return x[2][0]; }'
+assert 7 'int main() { int x[2][3]; int i=1; int j=2; x[i][j]=7; return x[1][2]; }'
+assert 8 'int main() { int x[4]; int i=0; for (i=0; i<4; i=i+1) x[i]=i*2; return x[3]+x[1]; }'
+assert 5 'int x[4]; int main() { int i=0; for (i=0; i<4; i=i+1) x[i]=i+2; i=2; return x[i+1]; }'
+assert 4 'int main() { int x[4]; int *p=x+3; int i=2; *p=4; p[0-1]=1; return *(p-i+2); }'
+assert 3 'int main() { char x[4]; int i=2; x[i]=3; x[i+1]=9; return x[2]; }'
 
-assert 8 'int main() { int x; return sizeof(x); }'
-assert 8 'int main() { int x; return sizeof x; }'
+assert 4 'int main() { int x; return sizeof(x); }'
+assert 4 'int main() { int x; return sizeof x; }'
 assert 8 'int main() { int *x; return sizeof(x); }'
-assert 32 'int main() { int x[4]; return sizeof(x); }'
-assert 96 'int main() { int x[3][4]; return sizeof(x); }'
-assert 32 'int main() { int x[3][4]; return sizeof(*x); }'
-assert 8 'int main() { int x[3][4]; return sizeof(**x); }'
-assert 9 'int main() { int x[3][4]; return sizeof(**x) + 1; }'
-assert 9 'int main() { int x[3][4]; return sizeof **x + 1; }'
-assert 8 'int main() { int x[3][4]; return sizeof(**x + 1); }'
+assert 16 'int main() { int x[4]; return sizeof(x); }'
+assert 48 'int main() { int x[3][4]; return sizeof(x); }'
+assert 16 'int main() { int x[3][4]; return sizeof(*x); }'
+assert 4 'int main() { int x[3][4]; return sizeof(**x); }'
+assert 5 'int main() { int x[3][4]; return sizeof(**x) + 1; }'
+assert 5 'int main() { int x[3][4]; return sizeof **x + 1; }'
+assert 4 'int main() { int x[3][4]; return sizeof(**x + 1); }'
 
 assert 0 'int x; int main() { return x; }'
 assert 3 'int x; int main() { x=3; return x; }'
@@ -146,14 +224,39 @@ assert 0 'int x[4]; int main() { x[0]=0; x[1]=1; x[2]=2; x[3]=3; return x[0]; }'
 assert 1 'int x[4]; int main() { x[0]=0; x[1]=1; x[2]=2; x[3]=3; return x[1]; }'
 assert 2 'int x[4]; int main() { x[0]=0; x[1]=1; x[2]=2; x[3]=3; return x[2]; }'
 assert 3 'int x[4]; int main() { x[0]=0; x[1]=1; x[2]=2; x[3]=3; return x[3]; }'
-assert 8 'int x; int main() { return sizeof(x); }'
-assert 32 'int x[4]; int main() { return sizeof(x); }'
+assert 4 'int x; int main() { return sizeof(x); }'
+assert 16 'int x[4]; int main() { return sizeof(x); }'
+
+assert 2 'int main() { int x=2; { int x=3; } return x; }'
+assert 3 'int main() { int x=2; { int x=3; return x; } }'
+assert 5 'int main() { int x=2; { int x=3; { x=5; } return x; } }'
+assert 7 'int main() { int x=2; { x=7; int x=3; } return x; }'
+assert 4 'int x; int main() { x=4; { int x=3; } return x; }'
+assert 3 'int x; int main() { x=4; int x=3; return x; }'
+assert 6 'int main() { int i=0; int j=0; for (i=0; i<3; i=i+1) { int j=i; } { int j=6; return j; } }'
 
 assert 1 'int main() { char x=1; return x; }'
 assert 1 'int main() { char x=1; char y=2; return x; }'
 assert 2 'int main() { char x=1; char y=2; return y; }'
 assert 1 'int main() { char x; return sizeof(x); }'
 assert 10 'int main() { char x[10]; return sizeof(x); }'
+assert 8 'int main() { long x; return sizeof(x); }'
+assert 8 'int main() { int x; long y; return sizeof(x+y); }'
+assert 4 'int main() { char x; return sizeof(x+x); }'
+assert 40 'int main() { long x[5]; return sizeof(x); }'
+assert 1 'int main() { long x=65536; int y=0; x=x*65536*2+1; y=x; return y; }'
+assert 1 'int main() { long x=65536; int y[2]; x=x*65536*2+1; y[0]=x; return y[0]; }'
+assert 3 'int main() { long x=65536; x=x*65536+3; return x/65536/65536*3; }'
+assert 2 'int main() { int x=0-1; long y=x; return y+3; }'
+assert 6 'int main() { int x[3]; x[0]=1; x[1]=2; x[2]=3; return sum3(x); }'
+assert 7 'int main() { int x=0-3; return add(x, 10); }'
+assert 4 'long x; char y; int z; int main() { x=1; y=2; z=1; return x+y+z; }'
+assert 7 'long ladd(long a, long b) { return a+b; } int main() { return ladd(3, 4); }'
+assert 5 'int *p(int *x) { return x+1; } int main() { int x[2]; x[1]=5; return *p(x); }'
 assert 1 'int main() { return sub_char(7, 3, 3); } int sub_char(char a, char b, char c) { return a-b-c; }'
+assert 3 'int ************ g; int ************ f() { return 0; } int main() { int ************ p; p=f(); return 3; }'
+assert 3 'int main() { int an_identifier_longer_than_thirty_two_bytes_x=1; int an_identifier_longer_than_thirty_two_bytes_y=2; return an_identifier_longer_than_thirty_two_bytes_x+an_identifier_longer_than_thirty_two_bytes_y; }'
+assert 42 'int main() { return 000000000000000000000000000000000000042; }'
+assert 5 "int main() {                                        $(printf '\t\n\v\f\r  %.0s' 1 2 3 4 5 6 7 8) return 5; }"
 
 echo OK
\ No newline at end of file
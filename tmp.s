@@ -0,0 +1,16 @@
+.intel_syntax noprefix
+.data
+.text
+.global main
+main:
+  push rbp
+  mov rbp, rsp
+  sub rsp, 16
+.L.entry.main:
+.L1:
+  mov rax, 5
+.L2:
+.L.return.main:
+  mov rsp, rbp
+  pop rbp
+  ret
@@ -0,0 +1,171 @@
+.intel_syntax noprefix
+.data
+.align 4
+total:
+  .zero 4
+.align 4
+w:
+  .zero 16
+.align 4
+a:
+  .zero 4000
+.text
+.global main
+main:
+  push rbp
+  mov rbp, rsp
+  sub rsp, 96
+  mov [rbp-56], rbx
+  mov [rbp-64], r12
+  mov [rbp-72], r13
+  mov [rbp-80], r14
+  mov [rbp-88], r15
+.L.entry.main:
+.L1:
+  mov r14, 0
+  mov r13, 1000
+  mov r15, 0
+  lea rax, [rip+a+0]
+  mov [rbp-16], rax
+  cmp r15, r13
+  jge .L3
+.L2:
+  mov rax, [rbp-16]
+  mov [rax+r15*4], r15d
+  add r15, 1
+  cmp r15, r13
+  jl .L2
+.L3:
+  mov rax, 0
+  mov [rbp-20], eax
+  mov rax, 1
+  mov [rip+w+0], eax
+  mov rax, 2
+  mov [rip+w+4], eax
+  mov rax, 3
+  mov [rip+w+8], eax
+  mov rax, 4
+  mov [rip+w+12], eax
+  mov rax, 4
+  mov [rbp-20], eax
+  mov rbx, 0
+  lea rax, [rip+a+0]
+  mov [rbp-8], rax
+  cmp rbx, 200000
+  jge .L5
+.L4:
+  mov r15, 0
+  lea r12, [rip+a+0]
+  cmp r15, r13
+  jge .L7
+.L6:
+  movsxd rax, dword ptr [r12+r15*4]
+  mov qword ptr [rbp-32], rax
+  add r14, qword ptr [rbp-32]
+  add r15, 1
+  cmp r15, r13
+  jl .L6
+.L7:
+  mov rax, 0
+  mov [rbp-20], eax
+  movsxd rax, dword ptr [rip+w+0]
+  mov qword ptr [rbp-32], rax
+  mov rax, [rbp-8]
+  mov qword ptr [rbp-40], rax
+  mov rax, -6640827866535438581
+  imul rbx
+  add rdx, rbx
+  sar rdx, 7
+  mov rax, rdx
+  shr rax, 63
+  add rax, rdx
+  mov qword ptr [rbp-48], rax
+  mov rdx, rax
+  mov rax, qword ptr [rbp-40]
+  movsxd rax, dword ptr [rax+rdx*4]
+  mov qword ptr [rbp-40], rax
+  mov rax, qword ptr [rbp-32]
+  imul rax, qword ptr [rbp-40]
+  mov qword ptr [rbp-32], rax
+  add r14, qword ptr [rbp-32]
+  movsxd rax, dword ptr [rip+w+4]
+  mov qword ptr [rbp-32], rax
+  mov rax, [rbp-8]
+  mov qword ptr [rbp-40], rax
+  mov rax, -6640827866535438581
+  imul rbx
+  add rdx, rbx
+  sar rdx, 7
+  mov rax, rdx
+  shr rax, 63
+  add rax, rdx
+  add rax, 1
+  mov qword ptr [rbp-48], rax
+  mov rdx, rax
+  mov rax, qword ptr [rbp-40]
+  movsxd rax, dword ptr [rax+rdx*4]
+  mov qword ptr [rbp-40], rax
+  mov rax, qword ptr [rbp-32]
+  imul rax, qword ptr [rbp-40]
+  mov qword ptr [rbp-32], rax
+  add r14, qword ptr [rbp-32]
+  movsxd rax, dword ptr [rip+w+8]
+  mov qword ptr [rbp-32], rax
+  mov rax, [rbp-8]
+  mov qword ptr [rbp-40], rax
+  mov rax, -6640827866535438581
+  imul rbx
+  add rdx, rbx
+  sar rdx, 7
+  mov rax, rdx
+  shr rax, 63
+  add rax, rdx
+  add rax, 2
+  mov qword ptr [rbp-48], rax
+  mov rdx, rax
+  mov rax, qword ptr [rbp-40]
+  movsxd rax, dword ptr [rax+rdx*4]
+  mov qword ptr [rbp-40], rax
+  mov rax, qword ptr [rbp-32]
+  imul rax, qword ptr [rbp-40]
+  mov qword ptr [rbp-32], rax
+  add r14, qword ptr [rbp-32]
+  movsxd rax, dword ptr [rip+w+12]
+  mov qword ptr [rbp-32], rax
+  mov rax, [rbp-8]
+  mov qword ptr [rbp-40], rax
+  mov rax, -6640827866535438581
+  imul rbx
+  add rdx, rbx
+  sar rdx, 7
+  mov rax, rdx
+  shr rax, 63
+  add rax, rdx
+  add rax, 3
+  mov qword ptr [rbp-48], rax
+  mov rdx, rax
+  mov rax, qword ptr [rbp-40]
+  movsxd rax, dword ptr [rax+rdx*4]
+  mov qword ptr [rbp-40], rax
+  mov rax, qword ptr [rbp-32]
+  imul rax, qword ptr [rbp-40]
+  mov qword ptr [rbp-32], rax
+  add r14, qword ptr [rbp-32]
+  mov rax, 4
+  mov [rbp-20], eax
+  add rbx, 1
+  cmp rbx, 200000
+  jl .L4
+.L5:
+  mov [rip+total+0], r14d
+  mov rax, 0
+.L8:
+.L.return.main:
+  mov rbx, [rbp-56]
+  mov r12, [rbp-64]
+  mov r13, [rbp-72]
+  mov r14, [rbp-80]
+  mov r15, [rbp-88]
+  mov rsp, rbp
+  pop rbp
+  ret
@@ -1,26 +1,109 @@
 #include <stdio.h>
 #include <stdarg.h>
 #include <stdbool.h>
+#include <string.h>
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
 #include "9cc.h"
 
-// Returns true if the current token matches a given string.
-Token *peek(char *s)
+// トークナイザ。
+// 入力全体のトークン列は作らず、パーサが読み進めるたびに次のトークンを
+// 切り出す。切り出したトークンは小さなリングバッファに置くので、
+// tokenが指すトークンは次に読み進めるまでしか有効でない。後で使う
+// トークンは値でコピーしておくこと。
+//
+// 読み戻し(is_function()の先読みなど)にはmark_token()で位置を覚え、
+// rewind_token()で戻る。覚えた位置からRING_SIZE個より先へは読み進められない。
+
+// トークンの種類ごとの表記。エラーメッセージで使う。
+static char *token_str[] = {
+    [TK_IDENT] = "識別子",
+    [TK_NUM] = "数",
+    [TK_EOF] = "入力の終わり",
+    [TK_PLUS] = "+",
+    [TK_MINUS] = "-",
+    [TK_STAR] = "*",
+    [TK_SLASH] = "/",
+    [TK_AMP] = "&",
+    [TK_LPAREN] = "(",
+    [TK_RPAREN] = ")",
+    [TK_LBRACE] = "{",
+    [TK_RBRACE] = "}",
+    [TK_LBRACKET] = "[",
+    [TK_RBRACKET] = "]",
+    [TK_COMMA] = ",",
+    [TK_SEMI] = ";",
+    [TK_ASSIGN] = "=",
+    [TK_EQ] = "==",
+    [TK_NE] = "!=",
+    [TK_LT] = "<",
+    [TK_LE] = "<=",
+    [TK_GT] = ">",
+    [TK_GE] = ">=",
+    [TK_RETURN] = "return",
+    [TK_IF] = "if",
+    [TK_ELSE] = "else",
+    [TK_FOR] = "for",
+    [TK_WHILE] = "while",
+    [TK_INT] = "int",
+    [TK_CHAR] = "char",
+    [TK_LONG] = "long",
+    [TK_SIZEOF] = "sizeof",
+};
+
+#define RING_SIZE 32 // 2のべき
+
+static Token ring[RING_SIZE];
+static long cur;       // tokenの通し番号
+static long end;       // 切り出し済みのトークンの数
+static long mark = -1; // mark_token()で覚えた位置。なければ-1
+static char *p;        // 次に切り出す位置
+static int line_no;
+
+static void lex(Token *tok);
+
+// トークンを1つ読み進める
+void next_token()
+{
+    if (++cur == end)
+    {
+        if (mark >= 0 && end - mark >= RING_SIZE)
+            error_at(p, "先読みが長すぎます");
+        lex(&ring[end++ % RING_SIZE]);
+    }
+    token = &ring[cur % RING_SIZE];
+}
+
+// 現在の位置を返す。rewind_token()に渡すまで、この位置以降のトークンを残しておく
+long mark_token()
+{
+    mark = cur;
+    return cur;
+}
+
+void rewind_token(long pos)
 {
-    if (token->kind != TK_RESERVED || strlen(s) != token->len ||
-        memcmp(token->str, s, token->len))
+    cur = pos;
+    mark = -1;
+    token = &ring[cur % RING_SIZE];
+}
+
+// Returns the current token if it is of the given kind.
+Token *peek(TokenKind kind)
+{
+    if (token->kind != kind)
         return NULL;
     return token;
 }
 
 // 次のトークンが期待している記号のときには、トークンを1つ読み進める。
 // それ以外の場合にはエラーを報告する。
-void expect(char *op)
+void expect(TokenKind kind)
 {
-    if (token->kind != TK_RESERVED ||
-        strlen(op) != token->len ||
-        memcmp(token->str, op, token->len))
-        error_at(token->str, "'%s'ではありません", op);
-    token = token->next;
+    if (token->kind != kind)
+        error_at(token->str, "'%s'ではありません", token_str[kind]);
+    next_token();
 }
 
 // 次のトークンが数値の場合、トークンを1つ読み進めてその数値を返す。
@@ -30,7 +113,7 @@ int expect_number()
     if (token->kind != TK_NUM)
         error_at(token->str, "数ではありません");
     int val = token->val;
-    token = token->next;
+    next_token();
     return val;
 }
 
@@ -39,148 +122,372 @@ bool at_eof()
     return token->kind == TK_EOF;
 }
 
-Token *new_token(TokenKind kind, Token *cur, char *str, int len)
+static void set_token(Token *tok, TokenKind kind, char *str, int len)
 {
-    Token *tok = calloc(1, sizeof(Token));
     tok->kind = kind;
     tok->str = str;
     tok->len = len;
-    cur->next = tok;
-    return tok;
+    tok->line_no = line_no;
 }
 
-bool startswith(char *p, char *q)
+//
+// 文字の分類
+//
+
+// 文字の種類。char_classの要素はこれらのビットの組み合わせ
+enum
 {
-    return memcmp(p, q, strlen(q)) == 0;
-}
+    CC_SPACE = 1,  // 空白
+    CC_DIGIT = 2,  // 数字
+    CC_IDENT1 = 4, // 識別子の先頭に使える文字
+    CC_IDENT2 = 8, // 識別子の2文字目以降に使える文字
+    CC_PUNCT = 16, // 記号の先頭の文字
+};
+
+// ロケールによらず、ASCII以外の文字はどれにも当たらない
+static unsigned char char_class[256];
 
-// Returns true if c is valid as the first character of an identifier.
-static bool is_ident1(char c)
+static void init_char_class()
 {
-    return ('a' <= c && c <= 'z') || ('A' <= c && c <= 'Z') || c == '_';
+    for (int c = 1; c < 256; c++)
+    {
+        int cls = 0;
+        if (c == ' ' || ('\t' <= c && c <= '\r'))
+            cls |= CC_SPACE;
+        if ('0' <= c && c <= '9')
+            cls |= CC_DIGIT | CC_IDENT2;
+        if (('a' <= c && c <= 'z') || ('A' <= c && c <= 'Z') || c == '_')
+            cls |= CC_IDENT1 | CC_IDENT2;
+        if (strchr("+-*/&(){}[],;=!<>", c))
+            cls |= CC_PUNCT;
+        char_class[c] = cls;
+    }
 }
-// Returns true if c is valid as a non-first character of an identifier.
-static bool is_ident2(char c)
+
+#define class_of(p) char_class[*(unsigned char *)(p)]
+
+//
+// 空白、識別子、数字の並びの終わりを探す。
+// SIMD版は16バイトまたは32バイトずつ調べるので、入力の終端のNULより
+// 最大INPUT_PADDINGバイト先まで読む。NULはどの並びにも含まれないので、
+// NULより先の内容で結果が変わることはない。
+//
+
+// pから続く空白を読み飛ばし、その後の位置を返す。改行の数を*linesに足す
+static char *skip_space_scalar(char *p, int *lines)
 {
-    return is_ident1(c) || ('0' <= c && c <= '9');
+    for (; class_of(p) & CC_SPACE; p++)
+        if (*p == '\n')
+            (*lines)++;
+    return p;
 }
 
-int is_alnum(char c)
+static char *skip_ident_scalar(char *p)
 {
-    return ('a' <= c && c <= 'z') ||
-           ('A' <= c && c <= 'Z') ||
-           ('0' <= c && c <= '9') ||
-           (c == '_');
+    while (class_of(p) & CC_IDENT2)
+        p++;
+    return p;
 }
 
-Token *tokenize()
+static char *skip_digits_scalar(char *p)
 {
-    char *p = user_input;
-    Token head;
-    head.next = NULL;
-    Token *cur = &head;
+    while (class_of(p) & CC_DIGIT)
+        p++;
+    return p;
+}
+
+#ifdef __x86_64__
+// 9ccは最適化なしでビルドするが、そのままでは組み込み関数の呼び出しが
+// 1つずつメモリを経由する命令列になり、スカラー版より遅くなる。
+// そのためSIMD版の関数だけは最適化してコンパイルする。
+#define KERNEL __attribute__((optimize("O2")))
+#define KERNEL_AVX2 __attribute__((target("avx2"), optimize("O2")))
 
-    while (*p)
+// SSE2はx86-64で必ず使えるので、AVX2がないときはこちらを使う。
+// 符号なし比較の命令がないので、a <= k は min(a, k) == a で調べる。
+#define LE_EPU8(a, k) _mm_cmpeq_epi8(_mm_min_epu8(a, _mm_set1_epi8(k)), a)
+
+KERNEL static char *skip_space_sse2(char *p, int *lines)
+{
+    for (;; p += 16)
     {
-        if (isspace(*p))
+        __m128i x = _mm_loadu_si128((__m128i *)p);
+        unsigned nl = _mm_movemask_epi8(_mm_cmpeq_epi8(x, _mm_set1_epi8('\n')));
+        __m128i sp = _mm_cmpeq_epi8(x, _mm_set1_epi8(' '));
+        __m128i ctl = LE_EPU8(_mm_sub_epi8(x, _mm_set1_epi8('\t')), '\r' - '\t');
+        unsigned end = ~_mm_movemask_epi8(_mm_or_si128(sp, ctl)) & 0xffff;
+        if (end)
         {
-            p++;
-            continue;
+            int n = __builtin_ctz(end);
+            *lines += __builtin_popcount(nl & ((1u << n) - 1));
+            return p + n;
         }
+        *lines += __builtin_popcount(nl);
+    }
+}
 
-        if (startswith(p, "==") || startswith(p, "!=") ||
-            startswith(p, "<=") || startswith(p, ">="))
-        {
-            cur = new_token(TK_RESERVED, cur, p, 2);
-            p += 2;
-            continue;
-        }
+// 英字は0x20との論理和で小文字にそろえてから範囲を調べる
+KERNEL static char *skip_ident_sse2(char *p)
+{
+    for (;; p += 16)
+    {
+        __m128i x = _mm_loadu_si128((__m128i *)p);
+        __m128i alpha = LE_EPU8(_mm_sub_epi8(_mm_or_si128(x, _mm_set1_epi8(0x20)), _mm_set1_epi8('a')), 'z' - 'a');
+        __m128i digit = LE_EPU8(_mm_sub_epi8(x, _mm_set1_epi8('0')), 9);
+        __m128i under = _mm_cmpeq_epi8(x, _mm_set1_epi8('_'));
+        unsigned end = ~_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(alpha, digit), under)) & 0xffff;
+        if (end)
+            return p + __builtin_ctz(end);
+    }
+}
 
-        if (strchr("+-*/()<>=;{},&[]", *p))
-        {
-            cur = new_token(TK_RESERVED, cur, p++, 1);
-            continue;
-        }
+KERNEL static char *skip_digits_sse2(char *p)
+{
+    for (;; p += 16)
+    {
+        __m128i x = _mm_loadu_si128((__m128i *)p);
+        unsigned end = ~_mm_movemask_epi8(LE_EPU8(_mm_sub_epi8(x, _mm_set1_epi8('0')), 9)) & 0xffff;
+        if (end)
+            return p + __builtin_ctz(end);
+    }
+}
 
-        if (isdigit(*p))
-        {
-            cur = new_token(TK_NUM, cur, p, 0);
-            char *q = p;
-            cur->val = strtol(p, &p, 10);
-            cur->len = p - q;
-            continue;
-        }
+#define LE_EPU8_256(a, k) _mm256_cmpeq_epi8(_mm256_min_epu8(a, _mm256_set1_epi8(k)), a)
 
-        if (strncmp(p, "return", 6) == 0 && !is_alnum(p[6]))
+KERNEL_AVX2 static char *skip_space_avx2(char *p, int *lines)
+{
+    for (;; p += 32)
+    {
+        __m256i x = _mm256_loadu_si256((__m256i *)p);
+        unsigned nl = _mm256_movemask_epi8(_mm256_cmpeq_epi8(x, _mm256_set1_epi8('\n')));
+        __m256i sp = _mm256_cmpeq_epi8(x, _mm256_set1_epi8(' '));
+        __m256i ctl = LE_EPU8_256(_mm256_sub_epi8(x, _mm256_set1_epi8('\t')), '\r' - '\t');
+        unsigned end = ~(unsigned)_mm256_movemask_epi8(_mm256_or_si256(sp, ctl));
+        if (end)
         {
-            cur = new_token(TK_RETURN, cur, p, 6);
-            p += 6;
-            continue;
+            int n = __builtin_ctz(end);
+            *lines += __builtin_popcount(nl & ((1ull << n) - 1));
+            return p + n;
         }
+        *lines += __builtin_popcount(nl);
+    }
+}
 
-        if (strncmp(p, "if", 2) == 0 && !is_alnum(p[2]))
-        {
-            cur = new_token(TK_RESERVED, cur, p, 2);
-            p += 2;
-            continue;
-        }
+KERNEL_AVX2 static char *skip_ident_avx2(char *p)
+{
+    for (;; p += 32)
+    {
+        __m256i x = _mm256_loadu_si256((__m256i *)p);
+        __m256i alpha = LE_EPU8_256(_mm256_sub_epi8(_mm256_or_si256(x, _mm256_set1_epi8(0x20)), _mm256_set1_epi8('a')), 'z' - 'a');
+        __m256i digit = LE_EPU8_256(_mm256_sub_epi8(x, _mm256_set1_epi8('0')), 9);
+        __m256i under = _mm256_cmpeq_epi8(x, _mm256_set1_epi8('_'));
+        unsigned end = ~(unsigned)_mm256_movemask_epi8(_mm256_or_si256(_mm256_or_si256(alpha, digit), under));
+        if (end)
+            return p + __builtin_ctz(end);
+    }
+}
 
-        if (strncmp(p, "else", 4) == 0 && !is_alnum(p[4]))
-        {
-            cur = new_token(TK_RESERVED, cur, p, 4);
-            p += 4;
-            continue;
-        }
+KERNEL_AVX2 static char *skip_digits_avx2(char *p)
+{
+    for (;; p += 32)
+    {
+        __m256i x = _mm256_loadu_si256((__m256i *)p);
+        unsigned end = ~(unsigned)_mm256_movemask_epi8(LE_EPU8_256(_mm256_sub_epi8(x, _mm256_set1_epi8('0')), 9));
+        if (end)
+            return p + __builtin_ctz(end);
+    }
+}
+#endif
 
-        if (strncmp(p, "for", 3) == 0 && !is_alnum(p[3]))
-        {
-            cur = new_token(TK_RESERVED, cur, p, 3);
-            p += 3;
-            continue;
-        }
+// tokenize()が実行時にCPUに合わせて選ぶ
+static char *(*skip_space)(char *p, int *lines);
+static char *(*skip_ident)(char *p);
+static char *(*skip_digits)(char *p);
 
-        if (strncmp(p, "while", 5) == 0 && !is_alnum(p[5]))
-        {
-            cur = new_token(TK_RESERVED, cur, p, 5);
-            p += 5;
-            continue;
-        }
+static void select_scanner()
+{
+    skip_space = skip_space_scalar;
+    skip_ident = skip_ident_scalar;
+    skip_digits = skip_digits_scalar;
+    if (opt_no_simd)
+        return;
+#ifdef __x86_64__
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        skip_space = skip_space_avx2;
+        skip_ident = skip_ident_avx2;
+        skip_digits = skip_digits_avx2;
+        return;
+    }
+    skip_space = skip_space_sse2;
+    skip_ident = skip_ident_sse2;
+    skip_digits = skip_digits_sse2;
+#endif
+}
 
-        if (strncmp(p, "int", 3) == 0 && !is_alnum(p[3]))
-        {
-            cur = new_token(TK_RESERVED, cur, p, 3);
-            p += 3;
-            continue;
-        }
+// 長さlenの識別子sがキーワードならその種類を、そうでなければTK_IDENTを返す。
+// 長さと先頭の文字で候補を1つに絞ってから比較するので、
+// キーワードが増えても識別子1つあたりの比較は高々1回で済む。
+static TokenKind keyword_kind(char *s, int len)
+{
+#define KW(str, kind) (memcmp(s, str, len) == 0 ? kind : TK_IDENT)
+    switch (len)
+    {
+    case 2:
+        if (s[0] == 'i')
+            return KW("if", TK_IF);
+        break;
+    case 3:
+        if (s[0] == 'f')
+            return KW("for", TK_FOR);
+        if (s[0] == 'i')
+            return KW("int", TK_INT);
+        break;
+    case 4:
+        if (s[0] == 'c')
+            return KW("char", TK_CHAR);
+        if (s[0] == 'e')
+            return KW("else", TK_ELSE);
+        if (s[0] == 'l')
+            return KW("long", TK_LONG);
+        break;
+    case 5:
+        if (s[0] == 'w')
+            return KW("while", TK_WHILE);
+        break;
+    case 6:
+        if (s[0] == 'r')
+            return KW("return", TK_RETURN);
+        if (s[0] == 's')
+            return KW("sizeof", TK_SIZEOF);
+        break;
+    }
+    return TK_IDENT;
+#undef KW
+}
 
-        if (strncmp(p, "sizeof", 6) == 0 && !is_alnum(p[6]))
-        {
-            cur = new_token(TK_RESERVED, cur, p, 6);
-            p += 6;
-            continue;
-        }
+// pが指す記号の種類と長さを返す。記号でなければTK_EOFを返す。
+static TokenKind read_punct(char *p, int *len)
+{
+    *len = 1;
+    switch (*p)
+    {
+    case '+':
+        return TK_PLUS;
+    case '-':
+        return TK_MINUS;
+    case '*':
+        return TK_STAR;
+    case '/':
+        return TK_SLASH;
+    case '&':
+        return TK_AMP;
+    case '(':
+        return TK_LPAREN;
+    case ')':
+        return TK_RPAREN;
+    case '{':
+        return TK_LBRACE;
+    case '}':
+        return TK_RBRACE;
+    case '[':
+        return TK_LBRACKET;
+    case ']':
+        return TK_RBRACKET;
+    case ',':
+        return TK_COMMA;
+    case ';':
+        return TK_SEMI;
+    }
 
-        if (strncmp(p, "char", 4) == 0 && !is_alnum(p[4]))
-        {
-            cur = new_token(TK_RESERVED, cur, p, 4);
-            p += 4;
-            continue;
-        }
+    bool eq = p[1] == '=';
+    if (eq)
+        *len = 2;
+    switch (*p)
+    {
+    case '=':
+        return eq ? TK_EQ : TK_ASSIGN;
+    case '!':
+        if (eq)
+            return TK_NE;
+        break;
+    case '<':
+        return eq ? TK_LE : TK_LT;
+    case '>':
+        return eq ? TK_GE : TK_GT;
+    }
+    return TK_EOF;
+}
+
+// pから次のトークンを1つ切り出してtokに入れる
+static void lex(Token *tok)
+{
+    int cls = class_of(p);
+    // 空白は1文字だけのことが多いので、続くときだけ並びの終わりを探す
+    if (cls & CC_SPACE)
+    {
+        if (*p++ == '\n')
+            line_no++;
+        if (class_of(p) & CC_SPACE)
+            p = skip_space(p, &line_no);
+        cls = class_of(p);
+    }
 
-        if (is_ident1(*p))
+    if (cls & CC_IDENT1)
+    {
+        char *start = p;
+        p = skip_ident(p + 1);
+        int len = p - start;
+        TokenKind kind = keyword_kind(start, len);
+        set_token(tok, kind, start, len);
+        if (kind == TK_IDENT)
+            tok->name = intern(start, len);
+        return;
+    }
+
+    if (cls & CC_PUNCT)
+    {
+        int len;
+        TokenKind kind = read_punct(p, &len);
+        if (kind != TK_EOF)
         {
-            char *start = p;
-            do
-            {
-                p++;
-            } while (is_ident2(*p));
-            cur = new_token(TK_IDENT, cur, start, p - start);
-            continue;
+            set_token(tok, kind, p, len);
+            p += len;
+            return;
         }
+    }
+
+    if (cls & CC_DIGIT)
+    {
+        char *start = p;
+        p = skip_digits(p);
+        unsigned long val = 0;
+        for (char *q = start; q < p; q++)
+            val = val * 10 + (*q - '0');
+        tok->val = val;
+        set_token(tok, TK_NUM, start, p - start);
+        return;
+    }
 
-        error_at(p, "トークナイズできません");
+    if (!*p)
+    {
+        set_token(tok, TK_EOF, p, 0);
+        return;
     }
 
-    new_token(TK_EOF, cur, p, 0);
-    return head.next;
-}
\ No newline at end of file
+    error_at(p, "トークナイズできません");
+}
+
+// user_inputの先頭から読み始め、tokenを最初のトークンにする
+void tokenize()
+{
+    init_char_class();
+    select_scanner();
+    p = user_input;
+    line_no = 1;
+    cur = end = 0;
+    mark = -1;
+    lex(&ring[end++]);
+    token = &ring[0];
+}
@@ -1,81 +1,87 @@
 #include "9cc.h"
 #include <stddef.h>
 
-Type *new_type(TypeKind kind)
+// 型は構造ごとに1つだけ作る。基本型は静的に置き、ポインタと配列は
+// 元の型に持たせた表から引くので、同じ型を求めると同じポインタが返る。
+// サイズとアラインメントは作るときに求めておく。
+
+static Type char_ty = {.kind = TY_CHAR, .size = 1, .align = 1};
+static Type int_ty = {.kind = TY_INT, .size = 4, .align = 4};
+static Type long_ty = {.kind = TY_LONG, .size = 8, .align = 8};
+
+static Type *new_type(TypeKind kind, Type *base, int size, int align)
 {
-    Type *ty = calloc(1, sizeof(Type));
+    Type *ty = arena_alloc(&type_arena, sizeof(Type));
     ty->kind = kind;
+    ty->base = base;
+    ty->size = size;
+    ty->align = align;
     return ty;
 }
 
 Type *char_type()
 {
-    return new_type(TY_CHAR);
+    return &char_ty;
 }
 
 Type *int_type()
 {
-    return new_type(TY_INT);
+    return &int_ty;
+}
+
+Type *long_type()
+{
+    return &long_ty;
 }
 
 Type *pointer_to(Type *base)
 {
-    Type *ty = new_type(TY_PTR);
-    ty->base = base;
-    return ty;
+    if (!base->pointer)
+        base->pointer = new_type(TY_PTR, base, 8, 8);
+    return base->pointer;
 }
 
 Type *array_of(Type *base, int size)
 {
-    Type *ty = new_type(TY_ARRAY);
-    ty->base = base;
+    for (Type *ty = base->arrays; ty; ty = ty->next)
+        if (ty->array_size == size)
+            return ty;
+
+    Type *ty = new_type(TY_ARRAY, base, base->size * size, base->align);
     ty->array_size = size;
+    ty->next = base->arrays;
+    base->arrays = ty;
     return ty;
 }
 
+// LP64: int は4バイト、long とポインタは8バイト
 int size_of(Type *ty)
 {
-    switch (ty->kind)
-    {
-    case TY_CHAR:
-        return 1;
-    case TY_INT:
-    case TY_PTR:
-        return 8;
-    default:
-        log("ty->kind: %d", ty->kind);
-        assert(ty->kind == TY_ARRAY);
-        return size_of(ty->base) * ty->array_size;
-    }
+    return ty->size;
 }
 
-void visit(Node *node)
+// 算術演算の結果の型。どちらかがlongならlong、そうでなければint
+static Type *arith_type(Type *a, Type *b)
 {
-    if (!node)
-        return;
-
-    visit(node->lhs);
-    visit(node->rhs);
-    visit(node->cond);
-    visit(node->then);
-    visit(node->els);
-    visit(node->init);
-    visit(node->inc);
-
-    for (int i = 0; node->body[i]; i++)
-        visit(node->body[i]);
-    for (int i = 0; node->args[i]; i++)
-        visit(node->args[i]);
+    if (a->kind == TY_LONG || b->kind == TY_LONG)
+        return long_type();
+    return int_type();
+}
 
+// パーサが作った式のノードに型を付ける。子のノードには型が付いている。
+// 型の誤りはtokの位置で報告する。
+void add_type(Node *node, Token *tok)
+{
     switch (node->kind)
     {
     case ND_MUL:
     case ND_DIV:
+        node->ty = arith_type(node->lhs->ty, node->rhs->ty);
+        return;
     case ND_EQ:
     case ND_NE:
     case ND_LT:
     case ND_LE:
-    case ND_FUNCALL:
     case ND_NUM:
         node->ty = int_type();
         return;
@@ -90,13 +96,13 @@ void visit(Node *node)
             node->rhs = tmp;
         }
         if (node->rhs->ty->base)
-            error("invalid pointer arithmetic operands");
-        node->ty = node->lhs->ty;
+            error_at(tok->str, "ポインタ同士は足せません");
+        node->ty = node->lhs->ty->base ? node->lhs->ty : arith_type(node->lhs->ty, node->rhs->ty);
         return;
     case ND_SUB:
         if (node->rhs->ty->base)
-            error("invalid pointer arithmetic operands");
-        node->ty = node->lhs->ty;
+            error_at(tok->str, "ポインタを引くことはできません");
+        node->ty = node->lhs->ty->base ? node->lhs->ty : arith_type(node->lhs->ty, node->rhs->ty);
         return;
     case ND_ASSIGN:
         node->ty = node->lhs->ty;
@@ -109,21 +115,10 @@ void visit(Node *node)
         return;
     case ND_DEREF:
         if (!node->lhs->ty->base)
-            error("invalid pointer dereference");
+            error_at(tok->str, "ポインタではないものを参照しています");
         node->ty = node->lhs->ty->base;
         return;
-    case ND_SIZEOF:
-        node->kind = ND_NUM;
-        node->ty = int_type();
-        node->val = size_of(node->lhs->ty);
-        node->lhs = NULL;
-        return;
+    default:
+        break;
     }
 }
-
-void add_type(Program *prog)
-{
-    for (Function *fn = prog->fns; fn; fn = fn->next)
-        for (int i = 0; fn->body[i]; i++)
-            visit(fn->body[i]);
-}
\ No newline at end of file